@@ -0,0 +1,605 @@
+// Micro benchmarks of the hot paths of the game.
+//
+// Every case prints one line of comma separated values:
+//   case,parameter,iterations,ns_per_iteration,ns_per_item
+// so that the results of different runs can be compared by scripts.
+//
+// Cases using Vulkan run on a headless device, which may be a software
+// implementation. They are skipped, with a message on stderr, if no device
+// is available.
+//
+// Usage: benchmark [case-name-filter]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <glm/vec2.hpp>
+
+#include "game/geo-wars/collision.hpp"
+#include "game/geo-wars/object.hpp"
+#include "game/geo-wars/particle.hpp"
+#include "visual/vk-camera-buffer-manager.hpp"
+#include "visual/vk-draw-command-cache.hpp"
+#include "visual/vk-swap-chain-manager.hpp"
+#include "visual/vk-utils.hpp"
+#include "visual/vk-vertex-buffer-manager.hpp"
+#include "visual/window.hpp"
+
+namespace pgw::benchmark {
+
+using Clock = std::chrono::steady_clock;
+
+// Prevents the compiler from optimizing away a computed value.
+inline void do_not_optimize(std::size_t value) {
+    static volatile std::size_t sink;
+    sink = value;
+}
+inline void do_not_optimize(float value) {
+    static volatile float sink;
+    sink = value;
+}
+
+// Runs the function repeatedly for at least the minimum time, and prints the
+// mean time per iteration. num_items is the amount of work per iteration.
+inline void run_case(
+    const char*                  name,
+    std::size_t                  parameter,
+    std::size_t                  num_items,
+    const std::function< void() >& f
+) {
+    constexpr auto min_time = std::chrono::milliseconds(200);
+
+    // Warm up caches and buffers
+    f();
+
+    std::size_t iterations = 0;
+    const auto start = Clock::now();
+    auto now = start;
+    do {
+        f();
+        ++iterations;
+        now = Clock::now();
+    } while(now - start < min_time);
+
+    const double ns = std::chrono::duration< double, std::nano >(now - start).count() / iterations;
+    std::printf(
+        "%s,%zu,%zu,%.1f,%.3f\n",
+        name, parameter, iterations, ns, ns / std::max< std::size_t >(num_items, 1)
+    );
+    std::fflush(stdout);
+}
+
+// A headless Vulkan device for the cases that need one.
+class VulkanContext {
+public:
+    VulkanContext() {
+        instance_ = vk_util::create_instance(true);
+        phys_dev_ = vk_util::pick_physical_device(instance_, VK_NULL_HANDLE);
+        qf_indices_ = vk_util::find_queue_families(phys_dev_, VK_NULL_HANDLE);
+
+        VkQueue present_queue;
+        std::tie(
+            device_,
+            graphics_queue_,
+            present_queue,
+            transfer_queue_
+        ) = vk_util::create_logical_device(phys_dev_, VK_NULL_HANDLE);
+
+        transfer_command_pool_ = vk_util::create_transfer_command_pool(device_, qf_indices_);
+        op_allocator_.emplace(phys_dev_, device_);
+    }
+    VulkanContext(const VulkanContext&) = delete;
+    VulkanContext& operator=(const VulkanContext&) = delete;
+
+    ~VulkanContext() {
+        vkDeviceWaitIdle(device_);
+        op_allocator_.reset();
+        vkDestroyCommandPool(device_, transfer_command_pool_, nullptr);
+        vkDestroyDevice(device_, nullptr);
+        vkDestroyInstance(instance_, nullptr);
+    }
+
+    // Accessors
+    auto phys_dev() const { return phys_dev_; }
+    const auto& qf_indices() const { return qf_indices_; }
+    auto device() const { return device_; }
+    auto transfer_queue() const { return transfer_queue_; }
+    auto transfer_command_pool() const { return transfer_command_pool_; }
+    auto& allocator() { return *op_allocator_; }
+
+private:
+    VkInstance       instance_;
+    VkPhysicalDevice phys_dev_;
+    vk_util::QueueFamilyIndices qf_indices_;
+    VkDevice         device_;
+    VkQueue          graphics_queue_;
+    VkQueue          transfer_queue_;
+    VkCommandPool    transfer_command_pool_;
+    std::optional< vk_util::MemoryAllocator > op_allocator_;
+};
+
+// Returns the shared Vulkan context, or nullptr if it cannot be created.
+inline VulkanContext* vulkan_context() {
+    static std::optional< VulkanContext > op_context;
+    static bool tried = false;
+    if(!tried) {
+        tried = true;
+        try {
+            op_context.emplace();
+        } catch(const std::runtime_error& e) {
+            std::fprintf(stderr, "Vulkan cases skipped: %s\n", e.what());
+        }
+    }
+    return op_context ? &*op_context : nullptr;
+}
+
+// Entities with random transforms, as drawn by the game.
+inline auto random_transforms(std::size_t num_entities) {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution< float > coord(-1.0f, 1.0f);
+    std::uniform_real_distribution< float > angle(0.0f, 6.2831853f);
+
+    std::vector< ShapeTransform > transforms(num_entities);
+    for(auto& t : transforms) {
+        t.rotation = angle(rng);
+        t.scale[0] = t.scale[1] = 0.05f;
+        t.position[0] = coord(rng);
+        t.position[1] = coord(rng);
+    }
+    return transforms;
+}
+
+//-------------------------------------
+// Cases
+//-------------------------------------
+
+// Broadphase over bodies at constant density, so that the time per body
+// should stay flat as the body count grows.
+inline void broadphase(std::size_t num_bodies) {
+    // About 4 bodies per unit area, with a radius similar to the cell size
+    constexpr float density = 4.0f;
+    const float half_extent = 0.5f * std::sqrt(num_bodies / density);
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution< float > coord(-half_extent, half_extent);
+    std::uniform_real_distribution< float > radius(0.05f, 0.3f);
+
+    std::vector< glm::vec2 > positions(num_bodies);
+    std::vector< float >     radii(num_bodies);
+    for(std::size_t i = 0; i < num_bodies; ++i) {
+        positions[i] = { coord(rng), coord(rng) };
+        radii[i] = radius(rng);
+    }
+
+    SpatialHashGrid grid(0.5f);
+    std::vector< CollisionPair > pairs;
+
+    run_case("broadphase", num_bodies, num_bodies, [&] {
+        pairs.clear();
+        grid.build(positions, radii);
+        grid.find_pairs(pairs);
+        do_not_optimize(pairs.size());
+    });
+}
+
+// Narrowphase on candidate pairs whose bounding circles mostly overlap, so
+// that most pairs reach the separating axis test.
+inline void narrowphase(std::size_t num_pairs) {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution< float > offset(-0.3f, 0.3f);
+    std::uniform_real_distribution< float > angle(0.0f, 6.2831853f);
+
+    EntityStore store;
+    std::vector< CollisionPair > candidates;
+    for(std::size_t i = 0; i < num_pairs; ++i) {
+        const glm::vec2 p { 10.0f * i, 0.0f };
+        const auto a = store.spawn({ p, {}, angle(rng), { 0.1f, 0.1f }, {}, 0 });
+        const auto b = store.spawn({ p + glm::vec2 { offset(rng), offset(rng) }, {}, angle(rng), { 0.1f, 0.1f }, {}, 1 });
+        candidates.push_back({ store.index(a), store.index(b) });
+    }
+
+    HullSet hulls({ shape_jet, shape_square });
+    hulls.build(store);
+    Narrowphase np;
+    std::vector< CollisionPair > contacts;
+
+    run_case("narrowphase", num_pairs, num_pairs, [&] {
+        contacts.clear();
+        np.find_contacts(hulls, candidates, contacts);
+        do_not_optimize(contacts.size());
+    });
+}
+
+// One 60 fps frame of a full particle pool: refill, update and writing
+// instances. With bursts of one second life, about 1/60 of the particles
+// are recycled every frame.
+inline void particles(std::size_t num_particles) {
+    ParticlePool pool(num_particles);
+    std::vector< InstanceData > instances(num_particles);
+
+    // Spread the ages of the initial particles
+    for(int frame = 0; frame < 60; ++frame) {
+        pool.emit_burst({}, num_particles / 60 + 1, 0.1f, 1.0f, { 1.0f, 1.0f, 1.0f }, 1.0f, 0.01f);
+        pool.update(1.0f / 60);
+    }
+
+    run_case("particles", num_particles, num_particles, [&] {
+        pool.emit_burst({}, pool.capacity() - pool.size(), 0.1f, 1.0f, { 1.0f, 1.0f, 1.0f }, 1.0f, 0.01f);
+        pool.update(1.0f / 60);
+        pool.write_instances(instances);
+        do_not_optimize(pool.size());
+    });
+}
+
+// Building the vertices of entity shapes one by one on the CPU.
+inline void build_shape_append(std::size_t num_entities) {
+    const auto transforms = random_transforms(num_entities);
+    std::vector< Vertex > vertices;
+    vertices.reserve(num_entities * shape_jet.size());
+
+    run_case("build_shape_append", num_entities, num_entities, [&] {
+        vertices.clear();
+        for(const auto& t : transforms) {
+            pgw::build_shape_append(vertices, shape_jet, t, { 1.0f, 1.0f, 1.0f });
+        }
+        do_not_optimize(vertices.size());
+    });
+}
+
+inline void transform_matrix(std::size_t num_entities) {
+    const auto transforms = random_transforms(num_entities);
+
+    run_case("transform_matrix", num_entities, num_entities, [&] {
+        float sum = 0;
+        for(const auto& t : transforms) {
+            sum += pgw::transform_matrix(t)[2][0];
+        }
+        do_not_optimize(sum);
+    });
+}
+
+// Streaming vertices to the device, alternating between the frames in
+// flight. The buffers are large enough after the warm up. All vertices
+// change every time, so they are all transferred.
+inline void copy_data(std::size_t num_vertices) {
+    const auto context = vulkan_context();
+    if(!context) return;
+
+    constexpr std::size_t num_frames = 2;
+    std::vector< Vertex > vertices(num_vertices);
+    vk_util::VertexBufferManager manager(
+        context->allocator(), context->device(), context->qf_indices(), context->transfer_command_pool(), context->transfer_queue(), num_frames
+    );
+
+    std::size_t frame = 0;
+    float x = 0;
+    run_case("copy_data", num_vertices, num_vertices, [&] {
+        x += 1.0f;
+        for(auto& v : vertices) v.pos.x = x;
+        manager.copy_data(vertices, frame);
+        manager.release_retired();
+        frame = (frame + 1) % num_frames;
+    });
+
+    vkDeviceWaitIdle(context->device());
+}
+
+// Same as copy_data, with only a few vertices changing each time, so that
+// the cost is mostly the comparison with the previous data.
+inline void copy_data_few_changes(std::size_t num_vertices) {
+    const auto context = vulkan_context();
+    if(!context) return;
+
+    constexpr std::size_t num_frames = 2;
+    constexpr std::size_t num_changes = 16;
+    std::vector< Vertex > vertices(num_vertices);
+    vk_util::VertexBufferManager manager(
+        context->allocator(), context->device(), context->qf_indices(), context->transfer_command_pool(), context->transfer_queue(), num_frames
+    );
+
+    std::size_t frame = 0;
+    std::mt19937 rng(42);
+    run_case("copy_data_few_changes", num_vertices, num_vertices, [&] {
+        for(std::size_t i = 0; i < num_changes; ++i) {
+            vertices[rng() % num_vertices].pos.x += 1.0f;
+        }
+        manager.copy_data(vertices, frame);
+        manager.release_retired();
+        frame = (frame + 1) % num_frames;
+    });
+
+    vkDeviceWaitIdle(context->device());
+}
+
+// Same as copy_data, with the vertices packed into the device layout while
+// they are copied.
+inline void copy_data_packed(std::size_t num_vertices) {
+    const auto context = vulkan_context();
+    if(!context) return;
+
+    constexpr std::size_t num_frames = 2;
+    std::vector< Vertex > vertices(num_vertices);
+    vk_util::VertexBufferManager manager(
+        context->allocator(), context->device(), context->qf_indices(), context->transfer_command_pool(), context->transfer_queue(), num_frames
+    );
+
+    std::size_t frame = 0;
+    float x = 0;
+    run_case("copy_data_packed", num_vertices, num_vertices, [&] {
+        x += 1.0f;
+        for(auto& v : vertices) v.pos.x = x;
+        manager.copy_converted_data(vertices, frame, to_device_vertex);
+        manager.release_retired();
+        frame = (frame + 1) % num_frames;
+    });
+
+    vkDeviceWaitIdle(context->device());
+}
+
+// Uploads of changing vertices until the device can read them: written
+// straight into device local host visible memory, or copied through a staging
+// buffer. Each upload waits for its transfer, so that the copy on the device
+// is included.
+inline void upload_path(const char* name, bool allow_direct_write, std::size_t num_vertices) {
+    const auto context = vulkan_context();
+    if(!context) return;
+
+    constexpr std::size_t num_frames = 2;
+    std::vector< Vertex > vertices(num_vertices);
+    vk_util::VertexBufferManager manager(
+        context->allocator(), context->device(), context->qf_indices(), context->transfer_command_pool(), context->transfer_queue(), num_frames,
+        1024, allow_direct_write
+    );
+    if(allow_direct_write && !manager.direct_write()) {
+        std::fprintf(stderr, "%s skipped: no device local host visible memory\n", name);
+        return;
+    }
+
+    std::size_t frame = 0;
+    float x = 0;
+    run_case(name, num_vertices, num_vertices, [&] {
+        x += 1.0f;
+        for(auto& v : vertices) v.pos.x = x;
+        manager.copy_data(vertices, frame);
+        vkQueueWaitIdle(context->transfer_queue());
+        manager.release_retired();
+        frame = (frame + 1) % num_frames;
+    });
+
+    vkDeviceWaitIdle(context->device());
+}
+inline void upload_direct(std::size_t num_vertices) {
+    upload_path("upload_direct", true, num_vertices);
+}
+inline void upload_staging(std::size_t num_vertices) {
+    upload_path("upload_staging", false, num_vertices);
+}
+
+// The first copy into a new manager, which always reallocates the buffers.
+// The time includes creating and destroying the manager.
+inline void copy_data_realloc(std::size_t num_vertices) {
+    const auto context = vulkan_context();
+    if(!context) return;
+
+    constexpr std::size_t num_frames = 2;
+    const std::vector< Vertex > vertices(num_vertices);
+
+    run_case("copy_data_realloc", num_vertices, num_vertices, [&] {
+        vk_util::VertexBufferManager manager(
+            context->allocator(), context->device(), context->qf_indices(), context->transfer_command_pool(), context->transfer_queue(), num_frames
+        );
+        manager.copy_data(vertices, 0);
+        vkDeviceWaitIdle(context->device());
+    });
+}
+
+// Creating and destroying a number of small buffers, sub-allocated from
+// memory blocks.
+inline void create_buffers(std::size_t num_buffers) {
+    const auto context = vulkan_context();
+    if(!context) return;
+
+    auto& allocator = context->allocator();
+    std::vector< std::tuple< VkBuffer, vk_util::MemoryAllocation > > buffers;
+    buffers.reserve(num_buffers);
+
+    run_case("create_buffers", num_buffers, num_buffers, [&] {
+        for(std::size_t i = 0; i < num_buffers; ++i) {
+            buffers.push_back(vk_util::create_buffer(
+                allocator, 4096,
+                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+            ));
+        }
+        for(const auto& [buffer, memory] : buffers) {
+            vk_util::destroy_buffer(allocator, buffer, memory);
+        }
+        buffers.clear();
+    });
+}
+
+// Recording the graphics command buffer with a number of instanced draws,
+// against offscreen images. Nothing is submitted.
+inline void record_graphics_command_buffer(std::size_t num_draws) {
+    const auto context = vulkan_context();
+    if(!context) return;
+
+    const auto device = context->device();
+    vk_util::CameraBufferManager cameras(context->allocator(), device, 1);
+    vk_util::SwapChainManager targets(
+        context->phys_dev(),
+        VK_NULL_HANDLE,
+        context->qf_indices(),
+        device,
+        context->allocator(),
+        VK_NULL_HANDLE,
+        800, 600,
+        Window::make_pipeline_descs(cameras.set_layout())
+    );
+
+    // Never read, since nothing is submitted
+    auto [buffer, memory] = vk_util::create_buffer(
+        context->allocator(), 1024,
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+    );
+
+    std::vector< vk_util::InstanceBufferDraws > draws(1);
+    draws[0].instance_buffer = buffer;
+    for(std::size_t i = 0; i < num_draws; ++i) {
+        draws[0].draws.push_back({ 0, 6, 0, static_cast< std::uint32_t >(i), 1 });
+    }
+
+    run_case("record_graphics_command_buffer", num_draws, num_draws, [&] {
+        vkResetCommandPool(device, targets.command_pools()[0], 0);
+        vk_util::record_graphics_command_buffer(
+            targets.swap_chain_extent(),
+            targets.render_pass(),
+            targets.framebuffers()[0],
+            targets.command_buffers()[0],
+            targets.pipeline_layouts()[Window::pipeline_vertex],
+            cameras.descriptor_set(0),
+            targets.graphics_pipelines()[Window::pipeline_vertex],
+            buffer, 0, 3,
+            targets.graphics_pipelines()[Window::pipeline_instanced],
+            buffer,
+            buffer,
+            draws
+        );
+    });
+
+    // The same draws from the cache, which only records the primary command
+    // buffer in steady state
+    vk_util::DrawCommandCache cache(device, context->qf_indices(), 1);
+    std::vector< vk_util::DrawState > layers(1);
+    layers[0].swap_chain_extent = targets.swap_chain_extent();
+    layers[0].render_pass = targets.render_pass();
+    layers[0].pipeline_layout = targets.pipeline_layouts()[Window::pipeline_vertex];
+    layers[0].camera_set = cameras.descriptor_set(0);
+    layers[0].vertex_pipeline = targets.graphics_pipelines()[Window::pipeline_vertex];
+    layers[0].vertex_buffer = buffer;
+    layers[0].num_vertices = 3;
+    layers[0].instanced_pipeline = targets.graphics_pipelines()[Window::pipeline_instanced];
+    layers[0].mesh_buffer = buffer;
+    layers[0].mesh_index_buffer = buffer;
+    layers[0].instanced_draws = draws;
+
+    run_case("record_cached_draws", num_draws, num_draws, [&] {
+        vkResetCommandPool(device, targets.command_pools()[0], 0);
+        vk_util::record_graphics_command_buffer(
+            targets.swap_chain_extent(),
+            targets.render_pass(),
+            targets.framebuffers()[0],
+            targets.command_buffers()[0],
+            cache.command_buffers(0, layers)
+        );
+    });
+
+    // A camera shaking every frame, which only writes its uniform buffer
+    float shake = 0;
+    run_case("record_camera_motion", num_draws, num_draws, [&] {
+        shake = shake > 0 ? -0.01f : 0.01f;
+        vk_util::CameraUniforms camera;
+        camera.shake = { shake, 0.0f };
+        cameras.write(0, camera);
+        vkResetCommandPool(device, targets.command_pools()[0], 0);
+        vk_util::record_graphics_command_buffer(
+            targets.swap_chain_extent(),
+            targets.render_pass(),
+            targets.framebuffers()[0],
+            targets.command_buffers()[0],
+            cache.command_buffers(0, layers)
+        );
+    });
+
+    // Eight layers of the draws, all recorded again every time, in parallel
+    vk_util::DrawCommandCache parallel_cache(device, context->qf_indices(), 1, 3);
+    layers.assign(8, layers[0]);
+    run_case("record_parallel_layers", num_draws, 8 * num_draws, [&] {
+        parallel_cache.invalidate();
+        parallel_cache.command_buffers(0, layers);
+    });
+
+    vk_util::destroy_buffer(context->allocator(), buffer, memory);
+}
+
+// Full frames of a headless window drawing instanced entities, without a
+// frame rate limit. The window has its own device.
+inline void draw_frame(std::size_t num_entities) {
+    if(!vulkan_context()) return;
+
+    Window w(800, 600, WindowMode::headless);
+    const auto mesh_jet = w.add_mesh(build_mesh(shape_jet));
+
+    const std::vector< Vertex > vertices {
+        {{0.0f, -0.5f}, {1.0f, 0.0f, 0.0f}},
+        {{0.5f, 0.5f }, {0.0f, 1.0f, 0.0f}},
+        {{-0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}}
+    };
+    std::vector< InstanceData > instances;
+    for(const auto& t : random_transforms(num_entities)) {
+        instances.push_back(make_instance_data(t, { 1.0f, 1.0f, 1.0f }));
+    }
+    const std::vector< InstanceBatch > batches {
+        { mesh_jet, 0, static_cast< std::uint32_t >(num_entities) }
+    };
+
+    run_case("draw_frame", num_entities, num_entities, [&] {
+        w.run_frame([&] {
+            w.copy_vertex_data(vertices);
+            w.copy_instance_data(instances, batches);
+        });
+    });
+}
+
+struct Case {
+    const char*                        name;
+    std::vector< std::size_t >         parameters;
+    std::function< void(std::size_t) > run;
+};
+
+inline std::vector< Case > all_cases() {
+    return {
+        { "broadphase",  { 1000, 10000, 100000 }, broadphase },
+        { "narrowphase", { 1000, 4000, 16000 },   narrowphase },
+        { "particles",   { 10000, 200000 },       particles },
+        { "build_shape_append", { 100, 1000, 10000, 100000 }, build_shape_append },
+        { "transform_matrix",   { 100, 1000, 10000, 100000 }, transform_matrix },
+        { "copy_data",          { 1000, 100000, 1000000 },    copy_data },
+        { "copy_data_packed",   { 1000, 100000, 1000000 },    copy_data_packed },
+        { "copy_data_few_changes", { 1000, 100000, 1000000 }, copy_data_few_changes },
+        { "copy_data_realloc",  { 1000, 100000, 1000000 },    copy_data_realloc },
+        { "upload_direct",      { 1000, 100000, 1000000 },    upload_direct },
+        { "upload_staging",     { 1000, 100000, 1000000 },    upload_staging },
+        { "create_buffers",     { 16, 1024 },                 create_buffers },
+        { "record_graphics_command_buffer", { 1, 64, 1024 },  record_graphics_command_buffer },
+        { "draw_frame",         { 1000, 100000 },             draw_frame },
+    };
+}
+
+} // namespace pgw::benchmark
+
+int main(int argc, char** argv) {
+    using namespace pgw::benchmark;
+
+    const std::string filter = argc > 1 ? argv[1] : "";
+
+    std::printf("case,parameter,iterations,ns_per_iteration,ns_per_item\n");
+    for(const auto& c : all_cases()) {
+        if(std::string(c.name).find(filter) == std::string::npos) continue;
+        for(auto p : c.parameters) {
+            c.run(p);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,592 @@
+#ifndef PGW_GAME_GEO_WARS_COLLISION_HPP
+#define PGW_GAME_GEO_WARS_COLLISION_HPP
+
+#include <algorithm> // max, min
+#include <bit>       // bit_ceil
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include <glm/vec2.hpp>
+
+#include "game/geo-wars/entity.hpp"
+#include "game/geo-wars/object.hpp"
+#include "utility/cpu-features.hpp"
+
+namespace pgw {
+
+// A pair of bodies that may be colliding, with a < b.
+struct CollisionPair {
+    std::uint32_t a = 0;
+    std::uint32_t b = 0;
+};
+
+// The radius of the bounding circle of the shape around its origin.
+inline float shape_bounding_radius(const std::vector< glm::vec2 >& shape) {
+    float r2 = 0;
+    for(const auto& v : shape) {
+        r2 = std::max(r2, v.x * v.x + v.y * v.y);
+    }
+    return std::sqrt(r2);
+}
+
+// Computes the bounding radius of every entity, given the bounding radius of
+// each shape.
+inline void compute_bounding_radii(
+    const EntityStore&          store,
+    const std::vector< float >& shape_radii,
+    std::vector< float >&       radii
+) {
+    const std::uint32_t n = store.size();
+    const auto& scales = store.scales();
+    const auto& shapes = store.shapes();
+
+    radii.resize(n);
+    for(std::uint32_t i = 0; i < n; ++i) {
+        const auto s = std::max(std::abs(scales[i].x), std::abs(scales[i].y));
+        radii[i] = s * shape_radii[shapes[i]];
+    }
+}
+
+//-------------------------------------
+// Broadphase
+//-------------------------------------
+
+// Uniform grid broadphase using spatial hashing.
+//
+// Every body is inserted into all grid cells overlapped by its bounding box.
+// Cells are hashed into a table with at least as many buckets as entries, and
+// the entries are counting-sorted by bucket into one flat array, so building
+// the grid does no allocation once the buffers have grown to size.
+//
+// The cell size should be about the diameter of typical bodies. Much larger
+// bodies work, but are inserted into many cells.
+class SpatialHashGrid {
+public:
+    explicit SpatialHashGrid(float cell_size) :
+        cell_size_(cell_size),
+        inv_cell_size_(1.0f / cell_size)
+    {
+        if(!(cell_size > 0)) {
+            throw std::runtime_error("Cell size of spatial hash grid must be positive.");
+        }
+    }
+
+    // Rebuilds the grid from the bounding circles of all bodies.
+    void build(
+        std::span< const glm::vec2 > positions,
+        std::span< const float >     radii
+    ) {
+        const std::uint32_t n = positions.size();
+
+        // Bounding boxes and their cells
+        boxes_.resize(n);
+        std::size_t num_entries = 0;
+        for(std::uint32_t i = 0; i < n; ++i) {
+            auto& box = boxes_[i];
+            box.min = positions[i] - glm::vec2 { radii[i], radii[i] };
+            box.max = positions[i] + glm::vec2 { radii[i], radii[i] };
+            box.cell_min_x = cell_coord_(box.min.x);
+            box.cell_min_y = cell_coord_(box.min.y);
+            box.cell_max_x = cell_coord_(box.max.x);
+            box.cell_max_y = cell_coord_(box.max.y);
+
+            num_entries += std::size_t(box.cell_max_x - box.cell_min_x + 1) * (box.cell_max_y - box.cell_min_y + 1);
+        }
+
+        // Hash table with load factor at most 1
+        const std::size_t num_buckets = std::bit_ceil(std::max< std::size_t >(num_entries, 1));
+        bucket_mask_ = num_buckets - 1;
+
+        // Count entries in each bucket
+        bucket_starts_.assign(num_buckets + 1, 0);
+        for_each_entry_([&](std::uint32_t, std::uint64_t, std::size_t bucket) {
+            ++bucket_starts_[bucket + 1];
+        });
+        for(std::size_t b = 0; b < num_buckets; ++b) {
+            bucket_starts_[b + 1] += bucket_starts_[b];
+        }
+
+        // Scatter entries into their buckets
+        entries_.resize(num_entries);
+        bucket_fill_.assign(bucket_starts_.begin(), bucket_starts_.end() - 1);
+        for_each_entry_([&](std::uint32_t body, std::uint64_t key, std::size_t bucket) {
+            entries_[bucket_fill_[bucket]++] = { key, body };
+        });
+    }
+
+    // Finds all pairs of bodies with overlapping bounding boxes.
+    //
+    // Each pair is reported exactly once: only in the cell containing the
+    // minimum corner of the overlap of the two boxes. The pairs are appended
+    // to the output.
+    void find_pairs(std::vector< CollisionPair >& pairs) const {
+        const std::size_t num_buckets = bucket_starts_.empty() ? 0 : bucket_starts_.size() - 1;
+
+        for(std::size_t b = 0; b < num_buckets; ++b) {
+            const auto begin = bucket_starts_[b];
+            const auto end   = bucket_starts_[b + 1];
+
+            for(auto i = begin; i < end; ++i) {
+                const auto& ei = entries_[i];
+                const auto& bi = boxes_[ei.body];
+
+                for(auto j = i + 1; j < end; ++j) {
+                    const auto& ej = entries_[j];
+                    // Different cells sharing a bucket
+                    if(ej.key != ei.key) continue;
+
+                    const auto& bj = boxes_[ej.body];
+                    if(bi.max.x < bj.min.x || bj.max.x < bi.min.x || bi.max.y < bj.min.y || bj.max.y < bi.min.y) continue;
+
+                    // Report only in the cell of the overlap minimum corner
+                    const auto overlap_cell_x = std::max(bi.cell_min_x, bj.cell_min_x);
+                    const auto overlap_cell_y = std::max(bi.cell_min_y, bj.cell_min_y);
+                    if(cell_key_(overlap_cell_x, overlap_cell_y) != ei.key) continue;
+
+                    pairs.push_back(
+                        ei.body < ej.body
+                            ? CollisionPair { ei.body, ej.body }
+                            : CollisionPair { ej.body, ei.body }
+                    );
+                }
+            }
+        }
+    }
+
+    // Accessors
+    auto cell_size() const { return cell_size_; }
+    auto num_entries() const { return entries_.size(); }
+
+private:
+    struct Box {
+        glm::vec2    min;
+        glm::vec2    max;
+        std::int32_t cell_min_x, cell_min_y;
+        std::int32_t cell_max_x, cell_max_y;
+    };
+    struct Entry {
+        std::uint64_t key; // The cell
+        std::uint32_t body;
+    };
+
+    std::int32_t cell_coord_(float x) const {
+        return static_cast< std::int32_t >(std::floor(x * inv_cell_size_));
+    }
+    static std::uint64_t cell_key_(std::int32_t x, std::int32_t y) {
+        return (std::uint64_t(std::uint32_t(x)) << 32) | std::uint32_t(y);
+    }
+    std::size_t bucket_(std::uint64_t key) const {
+        // Multiplicative hashing, folding the high bits into the low bits
+        auto h = key * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 32;
+        return h & bucket_mask_;
+    }
+
+    // Calls f(body, key, bucket) for every cell of every body.
+    template< typename F >
+    void for_each_entry_(F&& f) const {
+        const std::uint32_t n = boxes_.size();
+        for(std::uint32_t i = 0; i < n; ++i) {
+            const auto& box = boxes_[i];
+            for(auto x = box.cell_min_x; x <= box.cell_max_x; ++x) {
+                for(auto y = box.cell_min_y; y <= box.cell_max_y; ++y) {
+                    const auto key = cell_key_(x, y);
+                    f(i, key, bucket_(key));
+                }
+            }
+        }
+    }
+
+
+    float cell_size_;
+    float inv_cell_size_;
+
+    // Per body data
+    std::vector< Box > boxes_;
+
+    // Hash table in counting-sorted layout
+    std::size_t                 bucket_mask_ = 0;
+    std::vector< std::size_t >  bucket_starts_; // Size is number of buckets + 1
+    std::vector< std::size_t >  bucket_fill_;
+    std::vector< Entry >        entries_;
+};
+
+
+//-------------------------------------
+// Hulls
+//-------------------------------------
+
+// Shapes used for collision may have at most this many vertices.
+constexpr std::size_t max_hull_vertices = 8;
+
+// The world space convex hulls of all entities, computed once per tick.
+//
+// Entities are grouped by shape, and each group is transformed with
+// transform_shape_batch. Every shape is padded to max_hull_vertices by
+// repeating its last vertex, so all hulls have the same number of vertices.
+// The padding only adds zero length edges, which never separate two hulls.
+class HullSet {
+public:
+    // Shapes are indexed by the shape index of entities. They must be convex,
+    // with counter-clockwise or clockwise vertices.
+    explicit HullSet(const std::vector< std::vector< glm::vec2 > >& shapes) {
+        for(const auto& shape : shapes) {
+            if(shape.empty() || shape.size() > max_hull_vertices) {
+                throw std::runtime_error("Collision shape must have 1 to 8 vertices.");
+            }
+
+            auto padded = shape;
+            padded.resize(max_hull_vertices, shape.back());
+            padded_shapes_.push_back(std::move(padded));
+            shape_num_vertices_.push_back(shape.size());
+            shape_radii_.push_back(shape_bounding_radius(shape));
+        }
+    }
+
+    void build(const EntityStore& store) {
+        const std::uint32_t n = store.size();
+        const std::size_t num_shapes = padded_shapes_.size();
+        const auto& shapes = store.shapes();
+
+        positions_.assign(store.positions().begin(), store.positions().end());
+        compute_bounding_radii(store, shape_radii_, radii_);
+
+        // Group entities by shape
+        group_starts_.assign(num_shapes + 1, 0);
+        for(std::uint32_t i = 0; i < n; ++i) {
+            ++group_starts_[shapes[i] + 1];
+        }
+        for(std::size_t s = 0; s < num_shapes; ++s) {
+            group_starts_[s + 1] += group_starts_[s];
+        }
+
+        transforms_.resize(n);
+        firsts_.resize(n);
+        strides_.resize(n);
+        group_fill_.assign(group_starts_.begin(), group_starts_.end() - 1);
+        for(std::uint32_t i = 0; i < n; ++i) {
+            const auto s = shapes[i];
+            const auto k = group_fill_[s]++;
+            transforms_[k] = shape_transform(store, i);
+            // Vertex j is at first + j * stride
+            firsts_[i]  = group_starts_[s] * max_hull_vertices + (k - group_starts_[s]);
+            strides_[i] = group_starts_[s + 1] - group_starts_[s];
+        }
+
+        // Transform each group
+        x_.resize(std::size_t(n) * max_hull_vertices);
+        y_.resize(std::size_t(n) * max_hull_vertices);
+        for(std::size_t s = 0; s < num_shapes; ++s) {
+            const auto begin = group_starts_[s];
+            const auto count = group_starts_[s + 1] - begin;
+            if(count == 0) continue;
+
+            transform_shape_batch(
+                std::span(transforms_).subspan(begin, count),
+                padded_shapes_[s],
+                std::span(x_).subspan(begin * max_hull_vertices, count * max_hull_vertices),
+                std::span(y_).subspan(begin * max_hull_vertices, count * max_hull_vertices)
+            );
+        }
+
+        shapes_.assign(shapes.begin(), shapes.end());
+    }
+
+    // Vertex j of the hull of entity i, including padding vertices.
+    glm::vec2 vertex(std::uint32_t i, std::size_t j) const {
+        const auto index = firsts_[i] + j * strides_[i];
+        return { x_[index], y_[index] };
+    }
+    // Number of vertices of the hull of entity i, excluding padding.
+    std::size_t num_vertices(std::uint32_t i) const { return shape_num_vertices_[shapes_[i]]; }
+
+    // Accessors
+    std::uint32_t size() const { return positions_.size(); }
+    const auto& positions() const { return positions_; }
+    const auto& radii() const { return radii_; }
+
+private:
+    // Per shape data
+    std::vector< std::vector< glm::vec2 > > padded_shapes_;
+    std::vector< std::size_t >              shape_num_vertices_;
+    std::vector< float >                    shape_radii_;
+
+    // Per entity data
+    std::vector< glm::vec2 >     positions_;
+    std::vector< float >         radii_;
+    std::vector< std::uint32_t > shapes_;
+    std::vector< std::size_t >   firsts_;
+    std::vector< std::size_t >   strides_;
+
+    // Transformed vertices of all groups
+    std::vector< float > x_;
+    std::vector< float > y_;
+
+    // Scratch
+    std::vector< std::size_t >    group_starts_;
+    std::vector< std::size_t >    group_fill_;
+    std::vector< ShapeTransform > transforms_;
+};
+
+//-------------------------------------
+// Narrowphase
+//-------------------------------------
+namespace collision_detail {
+
+// The hulls of a block of pairs, in SoA layout for vector loads.
+template< std::size_t width >
+struct HullPairBlock {
+    alignas(32) float ax[max_hull_vertices][width], ay[max_hull_vertices][width];
+    alignas(32) float bx[max_hull_vertices][width], by[max_hull_vertices][width];
+
+    // Fills the block with count <= width pairs. The remaining lanes repeat
+    // the last pair.
+    void set(const HullSet& hulls, const CollisionPair* p_pairs, std::size_t count) {
+        for(std::size_t k = 0; k < width; ++k) {
+            const auto& pair = p_pairs[std::min(k, count - 1)];
+            for(std::size_t j = 0; j < max_hull_vertices; ++j) {
+                const auto va = hulls.vertex(pair.a, j);
+                const auto vb = hulls.vertex(pair.b, j);
+                ax[j][k] = va.x;
+                ay[j][k] = va.y;
+                bx[j][k] = vb.x;
+                by[j][k] = vb.y;
+            }
+        }
+    }
+};
+
+// Separating axis test of two convex hulls.
+inline bool hulls_overlap_scalar(const HullSet& hulls, const CollisionPair& pair) {
+    glm::vec2 va[max_hull_vertices], vb[max_hull_vertices];
+    for(std::size_t j = 0; j < max_hull_vertices; ++j) {
+        va[j] = hulls.vertex(pair.a, j);
+        vb[j] = hulls.vertex(pair.b, j);
+    }
+
+    const auto separated_on_edges = [&](const glm::vec2* p) {
+        for(std::size_t e = 0; e < max_hull_vertices; ++e) {
+            const auto& p0 = p[e];
+            const auto& p1 = p[(e + 1) % max_hull_vertices];
+            const float nx = p0.y - p1.y;
+            const float ny = p1.x - p0.x;
+
+            float min_a = va[0].x * nx + va[0].y * ny, max_a = min_a;
+            float min_b = vb[0].x * nx + vb[0].y * ny, max_b = min_b;
+            for(std::size_t j = 1; j < max_hull_vertices; ++j) {
+                const float pa = va[j].x * nx + va[j].y * ny;
+                const float pb = vb[j].x * nx + vb[j].y * ny;
+                min_a = std::min(min_a, pa); max_a = std::max(max_a, pa);
+                min_b = std::min(min_b, pb); max_b = std::max(max_b, pb);
+            }
+            if(max_a < min_b || max_b < min_a) return true;
+        }
+        return false;
+    };
+
+    return !separated_on_edges(va) && !separated_on_edges(vb);
+}
+
+#if PGW_SIMD_X86
+// Returns the bit mask of overlapping lanes.
+inline unsigned hulls_overlap_sse2(const HullPairBlock< 4 >& block) {
+    constexpr std::size_t nv = max_hull_vertices;
+    __m128 separated = _mm_setzero_ps();
+
+    // Edges of a, then edges of b
+    for(int side = 0; side < 2; ++side) {
+        const auto px = side == 0 ? block.ax : block.bx;
+        const auto py = side == 0 ? block.ay : block.by;
+
+        for(std::size_t e = 0; e < nv; ++e) {
+            const auto x0 = _mm_load_ps(px[e]);
+            const auto y0 = _mm_load_ps(py[e]);
+            const auto x1 = _mm_load_ps(px[(e + 1) % nv]);
+            const auto y1 = _mm_load_ps(py[(e + 1) % nv]);
+            const auto nx = _mm_sub_ps(y0, y1);
+            const auto ny = _mm_sub_ps(x1, x0);
+
+            auto min_a = _mm_add_ps(_mm_mul_ps(_mm_load_ps(block.ax[0]), nx), _mm_mul_ps(_mm_load_ps(block.ay[0]), ny));
+            auto min_b = _mm_add_ps(_mm_mul_ps(_mm_load_ps(block.bx[0]), nx), _mm_mul_ps(_mm_load_ps(block.by[0]), ny));
+            auto max_a = min_a;
+            auto max_b = min_b;
+            for(std::size_t j = 1; j < nv; ++j) {
+                const auto pa = _mm_add_ps(_mm_mul_ps(_mm_load_ps(block.ax[j]), nx), _mm_mul_ps(_mm_load_ps(block.ay[j]), ny));
+                const auto pb = _mm_add_ps(_mm_mul_ps(_mm_load_ps(block.bx[j]), nx), _mm_mul_ps(_mm_load_ps(block.by[j]), ny));
+                min_a = _mm_min_ps(min_a, pa); max_a = _mm_max_ps(max_a, pa);
+                min_b = _mm_min_ps(min_b, pb); max_b = _mm_max_ps(max_b, pb);
+            }
+            separated = _mm_or_ps(
+                separated,
+                _mm_or_ps(_mm_cmplt_ps(max_a, min_b), _mm_cmplt_ps(max_b, min_a))
+            );
+        }
+
+        // All lanes are already separated
+        if(_mm_movemask_ps(separated) == 0xf) return 0;
+    }
+    return ~_mm_movemask_ps(separated) & 0xfu;
+}
+
+PGW_TARGET_AVX2
+inline unsigned hulls_overlap_avx2(const HullPairBlock< 8 >& block) {
+    constexpr std::size_t nv = max_hull_vertices;
+    __m256 separated = _mm256_setzero_ps();
+
+    // Edges of a, then edges of b. No lambdas here, because they do not
+    // inherit the target attribute.
+    for(int side = 0; side < 2; ++side) {
+        const auto px = side == 0 ? block.ax : block.bx;
+        const auto py = side == 0 ? block.ay : block.by;
+
+        for(std::size_t e = 0; e < nv; ++e) {
+            const auto x0 = _mm256_load_ps(px[e]);
+            const auto y0 = _mm256_load_ps(py[e]);
+            const auto x1 = _mm256_load_ps(px[(e + 1) % nv]);
+            const auto y1 = _mm256_load_ps(py[(e + 1) % nv]);
+            const auto nx = _mm256_sub_ps(y0, y1);
+            const auto ny = _mm256_sub_ps(x1, x0);
+
+            auto min_a = _mm256_fmadd_ps(_mm256_load_ps(block.ax[0]), nx, _mm256_mul_ps(_mm256_load_ps(block.ay[0]), ny));
+            auto min_b = _mm256_fmadd_ps(_mm256_load_ps(block.bx[0]), nx, _mm256_mul_ps(_mm256_load_ps(block.by[0]), ny));
+            auto max_a = min_a;
+            auto max_b = min_b;
+            for(std::size_t j = 1; j < nv; ++j) {
+                const auto pa = _mm256_fmadd_ps(_mm256_load_ps(block.ax[j]), nx, _mm256_mul_ps(_mm256_load_ps(block.ay[j]), ny));
+                const auto pb = _mm256_fmadd_ps(_mm256_load_ps(block.bx[j]), nx, _mm256_mul_ps(_mm256_load_ps(block.by[j]), ny));
+                min_a = _mm256_min_ps(min_a, pa); max_a = _mm256_max_ps(max_a, pa);
+                min_b = _mm256_min_ps(min_b, pb); max_b = _mm256_max_ps(max_b, pb);
+            }
+            separated = _mm256_or_ps(
+                separated,
+                _mm256_or_ps(_mm256_cmp_ps(max_a, min_b, _CMP_LT_OQ), _mm256_cmp_ps(max_b, min_a, _CMP_LT_OQ))
+            );
+        }
+
+        // All lanes are already separated
+        if(_mm256_movemask_ps(separated) == 0xff) return 0;
+    }
+    return ~_mm256_movemask_ps(separated) & 0xffu;
+}
+#endif
+
+} // namespace collision_detail
+
+// Exact collision tests of candidate pairs, such as from a broadphase.
+//
+// Candidates are first filtered by their bounding circles, and the remaining
+// pairs are tested with the separating axis theorem on their hulls, several
+// pairs at a time with SIMD. Touching hulls count as colliding.
+class Narrowphase {
+public:
+    // Appends the colliding pairs among the candidates to the output.
+    void find_contacts(
+        const HullSet&                     hulls,
+        std::span< const CollisionPair >   candidates,
+        std::vector< CollisionPair >&      contacts
+    ) {
+        const auto& positions = hulls.positions();
+        const auto& radii = hulls.radii();
+
+        // Bounding circle test
+        circle_pairs_.clear();
+        for(const auto& pair : candidates) {
+            const auto d = positions[pair.b] - positions[pair.a];
+            const auto r = radii[pair.a] + radii[pair.b];
+            if(d.x * d.x + d.y * d.y <= r * r) {
+                circle_pairs_.push_back(pair);
+            }
+        }
+
+        // Separating axis test
+        const std::size_t n = circle_pairs_.size();
+        const auto* p_pairs = circle_pairs_.data();
+        switch(simd_level()) {
+#if PGW_SIMD_X86
+        case SimdLevel::avx2:
+            find_contacts_blocks_< 8 >(hulls, p_pairs, n, contacts, collision_detail::hulls_overlap_avx2);
+            break;
+        case SimdLevel::sse2:
+            find_contacts_blocks_< 4 >(hulls, p_pairs, n, contacts, collision_detail::hulls_overlap_sse2);
+            break;
+#endif
+        default:
+            for(std::size_t i = 0; i < n; ++i) {
+                if(collision_detail::hulls_overlap_scalar(hulls, p_pairs[i])) {
+                    contacts.push_back(p_pairs[i]);
+                }
+            }
+            break;
+        }
+    }
+
+private:
+    template< std::size_t width, typename Kernel >
+    void find_contacts_blocks_(
+        const HullSet&                hulls,
+        const CollisionPair*          p_pairs,
+        std::size_t                   n,
+        std::vector< CollisionPair >& contacts,
+        Kernel&&                      kernel
+    ) {
+        collision_detail::HullPairBlock< width > block;
+        for(std::size_t i = 0; i < n; i += width) {
+            const auto count = std::min(width, n - i);
+            block.set(hulls, p_pairs + i, count);
+
+            const auto mask = kernel(block);
+            for(std::size_t k = 0; k < count; ++k) {
+                if(mask & (1u << k)) contacts.push_back(p_pairs[i + k]);
+            }
+        }
+    }
+
+    std::vector< CollisionPair > circle_pairs_;
+};
+
+//-------------------------------------
+// Collision system
+//-------------------------------------
+
+// Finds all colliding entities each tick, using the spatial hash broadphase
+// and the hull narrowphase.
+class CollisionSystem {
+public:
+    CollisionSystem(const std::vector< std::vector< glm::vec2 > >& shapes, float cell_size) :
+        hulls_(shapes),
+        grid_(cell_size)
+    {}
+
+    // Returns the colliding pairs of entity indices. The reference is valid
+    // until the next update.
+    const std::vector< CollisionPair >& update(const EntityStore& store) {
+        hulls_.build(store);
+        grid_.build(hulls_.positions(), hulls_.radii());
+
+        candidates_.clear();
+        grid_.find_pairs(candidates_);
+
+        contacts_.clear();
+        narrowphase_.find_contacts(hulls_, candidates_, contacts_);
+        return contacts_;
+    }
+
+    // The hulls of the last update
+    const auto& hulls() const { return hulls_; }
+
+private:
+    HullSet         hulls_;
+    SpatialHashGrid grid_;
+    Narrowphase     narrowphase_;
+
+    std::vector< CollisionPair > candidates_;
+    std::vector< CollisionPair > contacts_;
+};
+
+} // namespace pgw
+
+#endif
@@ -0,0 +1,269 @@
+#ifndef PGW_GAME_GEO_WARS_ENTITY_HPP
+#define PGW_GAME_GEO_WARS_ENTITY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include "game/geo-wars/object.hpp"
+
+namespace pgw {
+
+// A handle to an entity, which stays valid until the entity is despawned.
+//
+// The generation of a slot is bumped whenever its entity is despawned, so a
+// stale handle never refers to a new entity reusing the same slot.
+struct EntityHandle {
+    std::uint32_t slot = 0;
+    std::uint32_t generation = 0;
+
+    friend bool operator==(const EntityHandle&, const EntityHandle&) = default;
+};
+
+// The initial state of a new entity.
+struct EntityDesc {
+    glm::vec2     position { 0.0f, 0.0f };
+    glm::vec2     velocity { 0.0f, 0.0f };
+    float         rotation = 0;
+    glm::vec2     scale    { 1.0f, 1.0f };
+    glm::vec3     color    { 1.0f, 1.0f, 1.0f };
+    std::uint32_t shape = 0; // The mesh index of the shape
+};
+
+// Storage of all entities in structure-of-arrays layout.
+//
+// Live entities are packed in [0, size()) of every field array, so that an
+// update loop only streams over the fields it touches. Despawning moves the
+// last entity into the hole, so the order of entities is not stable; use
+// handles to refer to particular entities across frames.
+class EntityStore {
+public:
+
+    EntityHandle spawn(const EntityDesc& desc) {
+        std::uint32_t slot;
+        if(free_slots_.empty()) {
+            slot = slots_.size();
+            slots_.push_back({});
+        } else {
+            slot = free_slots_.back();
+            free_slots_.pop_back();
+        }
+
+        const std::uint32_t index = size();
+        slots_[slot].index = index;
+
+        positions_.push_back(desc.position);
+        prev_positions_.push_back(desc.position);
+        velocities_.push_back(desc.velocity);
+        rotations_.push_back(desc.rotation);
+        prev_rotations_.push_back(desc.rotation);
+        scales_.push_back(desc.scale);
+        colors_.push_back(desc.color);
+        shapes_.push_back(desc.shape);
+        index_slots_.push_back(slot);
+
+        return { slot, slots_[slot].generation };
+    }
+
+    // Despawns the entity in O(1), by moving the last entity into its place.
+    // Returns false if the handle is stale.
+    bool despawn(EntityHandle handle) {
+        if(!alive(handle)) return false;
+
+        const auto index = slots_[handle.slot].index;
+        const auto last  = size() - 1;
+
+        if(index != last) {
+            positions_[index]  = positions_[last];
+            prev_positions_[index] = prev_positions_[last];
+            velocities_[index] = velocities_[last];
+            rotations_[index]  = rotations_[last];
+            prev_rotations_[index] = prev_rotations_[last];
+            scales_[index]     = scales_[last];
+            colors_[index]     = colors_[last];
+            shapes_[index]     = shapes_[last];
+            index_slots_[index] = index_slots_[last];
+            slots_[index_slots_[index]].index = index;
+        }
+
+        positions_.pop_back();
+        prev_positions_.pop_back();
+        velocities_.pop_back();
+        rotations_.pop_back();
+        prev_rotations_.pop_back();
+        scales_.pop_back();
+        colors_.pop_back();
+        shapes_.pop_back();
+        index_slots_.pop_back();
+
+        ++slots_[handle.slot].generation;
+        free_slots_.push_back(handle.slot);
+
+        return true;
+    }
+
+    bool alive(EntityHandle handle) const {
+        return handle.slot < slots_.size() && slots_[handle.slot].generation == handle.generation;
+    }
+
+    // The index of a live entity in the field arrays. It is only valid until
+    // the next despawn.
+    std::uint32_t index(EntityHandle handle) const { return slots_[handle.slot].index; }
+    // The handle of the entity at the index.
+    EntityHandle handle(std::uint32_t index) const {
+        const auto slot = index_slots_[index];
+        return { slot, slots_[slot].generation };
+    }
+
+    std::uint32_t size() const { return positions_.size(); }
+
+    // Records the current positions and rotations as the state of the
+    // previous tick, used for interpolation. Should be called at the start of
+    // each simulation tick.
+    void save_previous_state() {
+        prev_positions_ = positions_;
+        prev_rotations_ = rotations_;
+    }
+
+    void reserve(std::size_t capacity) {
+        positions_.reserve(capacity);
+        prev_positions_.reserve(capacity);
+        velocities_.reserve(capacity);
+        rotations_.reserve(capacity);
+        prev_rotations_.reserve(capacity);
+        scales_.reserve(capacity);
+        colors_.reserve(capacity);
+        shapes_.reserve(capacity);
+        index_slots_.reserve(capacity);
+        slots_.reserve(capacity);
+    }
+
+    // Field arrays, indexed by entity index
+    auto      & positions()        { return positions_; }
+    const auto& positions()  const { return positions_; }
+    auto      & velocities()       { return velocities_; }
+    const auto& velocities() const { return velocities_; }
+    auto      & rotations()        { return rotations_; }
+    const auto& rotations()  const { return rotations_; }
+    auto      & scales()           { return scales_; }
+    const auto& scales()     const { return scales_; }
+    auto      & colors()           { return colors_; }
+    const auto& colors()     const { return colors_; }
+    auto      & shapes()           { return shapes_; }
+    const auto& shapes()     const { return shapes_; }
+    // State at the start of the current tick
+    const auto& prev_positions() const { return prev_positions_; }
+    const auto& prev_rotations() const { return prev_rotations_; }
+
+private:
+    struct Slot {
+        std::uint32_t index = 0;
+        std::uint32_t generation = 0;
+    };
+
+    // Fields of live entities
+    std::vector< glm::vec2 >     positions_;
+    std::vector< glm::vec2 >     prev_positions_;
+    std::vector< glm::vec2 >     velocities_;
+    std::vector< float >         rotations_;
+    std::vector< float >         prev_rotations_;
+    std::vector< glm::vec2 >     scales_;
+    std::vector< glm::vec3 >     colors_;
+    std::vector< std::uint32_t > shapes_;
+
+    // Mapping between handles and indices
+    std::vector< std::uint32_t > index_slots_; // Slot of each entity index
+    std::vector< Slot >          slots_;
+    std::vector< std::uint32_t > free_slots_;
+};
+
+
+//-------------------------------------
+// Entity systems
+//-------------------------------------
+
+// Moves all entities by their velocities.
+inline void integrate_positions(EntityStore& store, float dt) {
+    auto& positions = store.positions();
+    const auto& velocities = store.velocities();
+
+    const std::uint32_t n = store.size();
+    for(std::uint32_t i = 0; i < n; ++i) {
+        positions[i] += velocities[i] * dt;
+    }
+}
+
+inline auto shape_transform(const EntityStore& store, std::uint32_t index) {
+    ShapeTransform res;
+    res.rotation = store.rotations()[index];
+    res.scale[0] = store.scales()[index].x;
+    res.scale[1] = store.scales()[index].y;
+    res.position[0] = store.positions()[index].x;
+    res.position[1] = store.positions()[index].y;
+    return res;
+}
+
+// Builds instance data of n entities, grouped into one batch per shape by a
+// counting sort on the shape index. make_instance(i) returns the instance
+// data of the entity i. The output vectors are overwritten.
+template< typename MakeInstance >
+inline void build_instances_by_shape(
+    const std::vector< std::uint32_t >& shapes,
+    std::size_t                         num_shapes,
+    MakeInstance&&                      make_instance,
+    std::vector< InstanceData >&        instances,
+    std::vector< InstanceBatch >&       batches,
+    std::vector< std::uint32_t >&       scratch_counts
+) {
+    const std::uint32_t n = shapes.size();
+
+    // Count entities of each shape, and convert counts to batch offsets
+    scratch_counts.assign(num_shapes, 0);
+    for(std::uint32_t i = 0; i < n; ++i) {
+        ++scratch_counts[shapes[i]];
+    }
+
+    batches.clear();
+    std::uint32_t first = 0;
+    for(std::uint32_t s = 0; s < num_shapes; ++s) {
+        const auto count = scratch_counts[s];
+        if(count) {
+            batches.push_back({ s, first, count });
+        }
+        scratch_counts[s] = first;
+        first += count;
+    }
+
+    // Scatter
+    instances.resize(n);
+    for(std::uint32_t i = 0; i < n; ++i) {
+        instances[scratch_counts[shapes[i]]++] = make_instance(i);
+    }
+}
+
+// Builds instance data of all entities in the store.
+inline void build_instances(
+    const EntityStore&            store,
+    std::size_t                   num_shapes,
+    std::vector< InstanceData >&  instances,
+    std::vector< InstanceBatch >& batches,
+    std::vector< std::uint32_t >& scratch_counts
+) {
+    build_instances_by_shape(
+        store.shapes(),
+        num_shapes,
+        [&](std::uint32_t i) {
+            return make_instance_data(shape_transform(store, i), store.colors()[i]);
+        },
+        instances,
+        batches,
+        scratch_counts
+    );
+}
+
+} // namespace pgw
+
+#endif
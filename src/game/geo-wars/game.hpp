@@ -4,8 +4,13 @@
 #include <chrono>
 #include <iostream>
 #include <numbers>
+#include <utility> // swap
 
+#include "game/geo-wars/collision.hpp"
+#include "game/geo-wars/entity.hpp"
 #include "game/geo-wars/object.hpp"
+#include "game/geo-wars/particle.hpp"
+#include "game/geo-wars/simulation.hpp"
 #include "visual/window.hpp"
 
 namespace pgw {
@@ -22,39 +27,133 @@ inline void run_game() {
     Window w(800, 600);
 
     // set key callbacks
-    w.glfw_callbacks().key_callback = [](int key, int scancode, int action, int mods) -> void {
+    bool explode = false;
+    bool report_profile = false;
+    w.glfw_callbacks().key_callback = [&](int key, int scancode, int action, int mods) -> void {
         cout << "Key pressed " << key << " scancode=" << scancode << endl;
+        if(key == GLFW_KEY_SPACE && action == GLFW_PRESS) explode = true;
+        if(key == GLFW_KEY_P && action == GLFW_PRESS) report_profile = !report_profile;
     };
 
+    // Meshes
+    const auto mesh_jet = w.add_mesh(build_mesh(shape_jet));
+    const auto mesh_square = w.add_mesh(build_mesh(shape_square));
+    const std::size_t num_meshes = 2; // Meshes of entity shapes
+    const auto mesh_spark = w.add_mesh(build_mesh(shape_spark));
+
+    // Explosions are simulated on the GPU
+    w.enable_gpu_particles(mesh_spark, 1 << 18);
+
+    // Entities
+    Simulation sim;
+    auto& entities = sim.entities();
+    entities.spawn({
+        { 0.0f, 0.0f },
+        { 0.0f, 0.0f },
+        static_cast< float >(std::numbers::pi / 2),
+        { 0.1f, 0.1f },
+        { 1.0f, 1.0f, 0.7f },
+        mesh_jet
+    });
+    entities.spawn({
+        { -0.5f, -0.5f },
+        { 0.05f, 0.05f },
+        0.0f,
+        { 0.05f, 0.05f },
+        { 0.4f, 0.8f, 1.0f },
+        mesh_square
+    });
+
+    std::vector< InstanceData >  instances;
+    std::vector< InstanceBatch > batches;
+    std::vector< std::uint32_t > batch_scratch;
+    std::vector< InstanceBatch > particle_batches { { mesh_spark, 0, 0, 1 } };
+
+    // The screen shakes after explosions
+    Camera camera;
+    ScreenShake screen_shake;
+
+    // Trail particles are simulated on the render thread, once per frame
+    ParticlePool particles(200000);
+    const float tick_seconds = std::chrono::duration< float >(sim.tick_duration()).count();
+
+    // The simulation runs on its own thread at a fixed time step. Shapes are
+    // indexed the same as meshes.
+    sim.start([collisions = CollisionSystem({ shape_jet, shape_square }, 0.25f)](EntityStore& entities, float dt) mutable {
+        integrate_positions(entities, dt);
+
+        // Colliding entities exchange velocities, if they are approaching
+        auto& positions  = entities.positions();
+        auto& velocities = entities.velocities();
+        for(const auto& pair : collisions.update(entities)) {
+            const auto dp = positions[pair.b] - positions[pair.a];
+            const auto dv = velocities[pair.b] - velocities[pair.a];
+            if(dp.x * dv.x + dp.y * dv.y < 0) {
+                std::swap(velocities[pair.a], velocities[pair.b]);
+            }
+        }
+    });
+
     w.mainloop([&]{
         using namespace std;
         using namespace std::chrono;
 
-        // Replace vertices
-        if(vertices.size() == 3) {
-            ShapeTransform jet_transform {
-                std::numbers::pi / 2,
-                { 50.0f, 50.0f },
-                { 100.0f, 100.0f }
-            };
-            build_shape_append(
-                vertices,
-                shape_jet,
-                jet_transform,
-                glm::vec3 { 1.0f, 1.0f, 0.7f }
-            );
-        }
-        else {
-            vertices.resize(3);
-        }
-        w.copy_vertex_data(vertices);
-
         static auto last_time = steady_clock::now();
         auto this_time = steady_clock::now();
-        double fr = 1.0 / duration_cast<duration<double>>(this_time - last_time).count();
-        // cout << "frame_rate=" << fr << endl;
+        const float dt = duration_cast<duration<float>>(this_time - last_time).count();
         last_time = this_time;
+
+        // Frame time distribution of each stage, every few seconds, if
+        // toggled on with P
+        static auto last_report_time = this_time;
+        if(report_profile && this_time - last_report_time >= seconds(5)) {
+            w.profiler().report(cout);
+            last_report_time = this_time;
+        }
+
+        w.copy_vertex_data(vertices);
+
+        // Draw the latest state of the simulation
+        const auto& snapshot = sim.latest_snapshot();
+        build_instances(
+            snapshot,
+            sim.interpolation_alpha(snapshot, this_time),
+            num_meshes,
+            instances,
+            batches,
+            batch_scratch
+        );
+
+        // Trails behind moving entities
+        for(std::size_t i = 0; i < snapshot.positions.size(); ++i) {
+            const auto velocity = (snapshot.positions[i] - snapshot.prev_positions[i]) / tick_seconds;
+            if(velocity.x != 0 || velocity.y != 0) {
+                particles.emit({ snapshot.positions[i], velocity * -0.5f, snapshot.colors[i] * 0.6f, 0.5f, 0.005f });
+            }
+        }
+        particles.update(dt);
+
+        // An explosion on demand
+        if(explode && !snapshot.positions.empty()) {
+            w.emit_gpu_particles({ snapshot.positions[0], 0.1f, 1.0f, { 1.0f, 0.6f, 0.2f }, 1.5f, 0.01f, 20000 });
+            screen_shake.start(0.03f, 0.5f);
+            explode = false;
+        }
+        camera.shake = screen_shake.update(dt);
+        w.set_camera(camera);
+        w.advance_gpu_particles(dt);
+
+        // Entities are diffed with the previous frame
+        w.copy_instance_data(instances, batches);
+
+        // Particles change every frame, so they are written in place, and
+        // drawn over the entities
+        particles.write_instances(w.map_instance_data(particles.size()));
+        particle_batches[0].num_instances = static_cast< std::uint32_t >(particles.size());
+        w.submit_instance_data(particle_batches);
     });
+
+    sim.stop();
 }
 
 } // namespace pgw
@@ -1,11 +1,16 @@
 #ifndef PGW_GAME_GEO_WARS_OBJECT_HPP
 #define PGW_GAME_GEO_WARS_OBJECT_HPP
 
+#include <cmath>
+#include <cstddef>
+#include <span>
+#include <stdexcept>
 #include <vector>
 
 #include <glm/gtx/matrix_transform_2d.hpp>
 #include <glm/vec2.hpp>
 
+#include "utility/cpu-features.hpp"
 #include "visual/window.hpp"
 
 namespace pgw {
@@ -25,10 +30,13 @@ inline const std::vector< glm::vec2 > shape_square {
     { 1.0f, -1.0f }
 };
 
+// The shape is first offset by δ in its own frame, then scaled, rotated, and
+// finally placed at the world position.
 struct ShapeTransform {
     float rotation = 0;
     float scale[2] = { 1.0f, 1.0f };
     float δ[2]     = { 0.0f, 0.0f };
+    float position[2] = { 0.0f, 0.0f };
 };
 
 //-------------------------------------
@@ -40,7 +48,10 @@ inline auto transform_matrix(
     return
         glm::translate(
             glm::scale(
-                glm::rotate(glm::mat3(), transform.rotation),
+                glm::rotate(
+                    glm::translate(glm::mat3(1.0f), { transform.position[0], transform.position[1] }),
+                    transform.rotation
+                ),
                 { transform.scale[0], transform.scale[1] }
             ),
             { transform.δ[0], transform.δ[1] }
@@ -48,18 +59,20 @@ inline auto transform_matrix(
 }
 
 inline void build_shape_append(
-    std::vector< Vertex >&         vertex_list,
-    const std::vector< glm::vec2 > shape_original,
-    const ShapeTransform&          transform,
-    const glm::vec3&               color
+    std::vector< Vertex >&          vertex_list,
+    const std::vector< glm::vec2 >& shape_original,
+    const ShapeTransform&           transform,
+    const glm::vec3&                color
 ) {
     const int num_vertices = shape_original.size();
     const int original_num_vertices = vertex_list.size();
     vertex_list.resize(original_num_vertices + num_vertices);
 
+    const auto mat = transform_matrix(transform);
+
     for(int i = 0; i < num_vertices; ++i) {
         auto& coord_original = shape_original[i];
-        auto coord3 = transform_matrix(transform) * glm::vec3 { coord_original[0], coord_original[1], 1.0f };
+        auto coord3 = mat * glm::vec3 { coord_original[0], coord_original[1], 1.0f };
 
         vertex_list[original_num_vertices + i].pos.x = coord3.x;
         vertex_list[original_num_vertices + i].pos.y = coord3.y;
@@ -68,6 +81,242 @@ inline void build_shape_append(
     }
 }
 
+//-------------------------------------
+// Batched shape transformation
+//-------------------------------------
+namespace object_detail {
+
+// The transform as an affine map:
+//   x' = a x + b y + tx
+//   y' = c x + d y + ty
+// which is equivalent to transform_matrix.
+struct AffineCoefs {
+    float a, b, c, d, tx, ty;
+};
+inline auto affine_coefs(const ShapeTransform& transform) {
+    const float cr = std::cos(transform.rotation);
+    const float sr = std::sin(transform.rotation);
+
+    AffineCoefs res;
+    res.a  =  cr * transform.scale[0];
+    res.b  = -sr * transform.scale[1];
+    res.c  =  sr * transform.scale[0];
+    res.d  =  cr * transform.scale[1];
+    res.tx = res.a * transform.δ[0] + res.b * transform.δ[1] + transform.position[0];
+    res.ty = res.c * transform.δ[0] + res.d * transform.δ[1] + transform.position[1];
+    return res;
+}
+
+// Coefficients of a block of transforms, in SoA layout for vector loads.
+template< std::size_t width >
+struct AffineCoefsBlock {
+    alignas(32) float a[width], b[width], c[width], d[width], tx[width], ty[width];
+
+    void set(const ShapeTransform* p_transforms) {
+        for(std::size_t k = 0; k < width; ++k) {
+            const auto coefs = affine_coefs(p_transforms[k]);
+            a[k]  = coefs.a;
+            b[k]  = coefs.b;
+            c[k]  = coefs.c;
+            d[k]  = coefs.d;
+            tx[k] = coefs.tx;
+            ty[k] = coefs.ty;
+        }
+    }
+};
+
+// Transforms the shape with transforms in [begin, end).
+// See transform_shape_batch for the output layout.
+inline void transform_shape_batch_scalar(
+    const ShapeTransform*  p_transforms,
+    std::size_t            begin,
+    std::size_t            end,
+    std::size_t            num_transforms,
+    const glm::vec2*       p_shape,
+    std::size_t            num_vertices,
+    float*                 p_out_x,
+    float*                 p_out_y
+) {
+    for(std::size_t i = begin; i < end; ++i) {
+        const auto coefs = affine_coefs(p_transforms[i]);
+        for(std::size_t j = 0; j < num_vertices; ++j) {
+            const auto& p = p_shape[j];
+            p_out_x[j * num_transforms + i] = coefs.a * p.x + coefs.b * p.y + coefs.tx;
+            p_out_y[j * num_transforms + i] = coefs.c * p.x + coefs.d * p.y + coefs.ty;
+        }
+    }
+}
+
+#if PGW_SIMD_X86
+inline void transform_shape_batch_sse2(
+    const ShapeTransform*  p_transforms,
+    std::size_t            num_transforms,
+    const glm::vec2*       p_shape,
+    std::size_t            num_vertices,
+    float*                 p_out_x,
+    float*                 p_out_y
+) {
+    constexpr std::size_t width = 4;
+    const std::size_t num_full = num_transforms / width * width;
+
+    AffineCoefsBlock< width > block;
+    for(std::size_t i = 0; i < num_full; i += width) {
+        block.set(p_transforms + i);
+        const auto a  = _mm_load_ps(block.a);
+        const auto b  = _mm_load_ps(block.b);
+        const auto c  = _mm_load_ps(block.c);
+        const auto d  = _mm_load_ps(block.d);
+        const auto tx = _mm_load_ps(block.tx);
+        const auto ty = _mm_load_ps(block.ty);
+
+        for(std::size_t j = 0; j < num_vertices; ++j) {
+            const auto px = _mm_set1_ps(p_shape[j].x);
+            const auto py = _mm_set1_ps(p_shape[j].y);
+            const auto x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, px), _mm_mul_ps(b, py)), tx);
+            const auto y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c, px), _mm_mul_ps(d, py)), ty);
+            _mm_storeu_ps(p_out_x + j * num_transforms + i, x);
+            _mm_storeu_ps(p_out_y + j * num_transforms + i, y);
+        }
+    }
+
+    transform_shape_batch_scalar(
+        p_transforms, num_full, num_transforms, num_transforms,
+        p_shape, num_vertices, p_out_x, p_out_y
+    );
+}
+
+PGW_TARGET_AVX2
+inline void transform_shape_batch_avx2(
+    const ShapeTransform*  p_transforms,
+    std::size_t            num_transforms,
+    const glm::vec2*       p_shape,
+    std::size_t            num_vertices,
+    float*                 p_out_x,
+    float*                 p_out_y
+) {
+    constexpr std::size_t width = 8;
+    const std::size_t num_full = num_transforms / width * width;
+
+    AffineCoefsBlock< width > block;
+    for(std::size_t i = 0; i < num_full; i += width) {
+        block.set(p_transforms + i);
+        const auto a  = _mm256_load_ps(block.a);
+        const auto b  = _mm256_load_ps(block.b);
+        const auto c  = _mm256_load_ps(block.c);
+        const auto d  = _mm256_load_ps(block.d);
+        const auto tx = _mm256_load_ps(block.tx);
+        const auto ty = _mm256_load_ps(block.ty);
+
+        for(std::size_t j = 0; j < num_vertices; ++j) {
+            const auto px = _mm256_set1_ps(p_shape[j].x);
+            const auto py = _mm256_set1_ps(p_shape[j].y);
+            const auto x = _mm256_fmadd_ps(a, px, _mm256_fmadd_ps(b, py, tx));
+            const auto y = _mm256_fmadd_ps(c, px, _mm256_fmadd_ps(d, py, ty));
+            _mm256_storeu_ps(p_out_x + j * num_transforms + i, x);
+            _mm256_storeu_ps(p_out_y + j * num_transforms + i, y);
+        }
+    }
+
+    transform_shape_batch_scalar(
+        p_transforms, num_full, num_transforms, num_transforms,
+        p_shape, num_vertices, p_out_x, p_out_y
+    );
+}
+#endif
+
+} // namespace object_detail
+
+// Transforms one shape with many transforms at once.
+//
+// The output is in SoA layout, with one plane per shape vertex: the vertex j
+// of the shape under the transform i is written to
+//   (out_x[j * N + i], out_y[j * N + i])
+// where N is the number of transforms. Both output spans must have at least
+// N * (number of shape vertices) elements.
+//
+// The kernel is selected at runtime from the best SIMD level of the CPU.
+inline void transform_shape_batch(
+    std::span< const ShapeTransform > transforms,
+    const std::vector< glm::vec2 >&   shape_original,
+    std::span< float >                out_x,
+    std::span< float >                out_y
+) {
+    const auto num_transforms = transforms.size();
+    const auto num_vertices   = shape_original.size();
+    if(out_x.size() < num_transforms * num_vertices || out_y.size() < num_transforms * num_vertices) {
+        throw std::runtime_error("Output of shape transformation is too small.");
+    }
+
+    switch(simd_level()) {
+#if PGW_SIMD_X86
+    case SimdLevel::avx2:
+        object_detail::transform_shape_batch_avx2(
+            transforms.data(), num_transforms,
+            shape_original.data(), num_vertices,
+            out_x.data(), out_y.data()
+        );
+        break;
+    case SimdLevel::sse2:
+        object_detail::transform_shape_batch_sse2(
+            transforms.data(), num_transforms,
+            shape_original.data(), num_vertices,
+            out_x.data(), out_y.data()
+        );
+        break;
+#endif
+    default:
+        object_detail::transform_shape_batch_scalar(
+            transforms.data(), 0, num_transforms, num_transforms,
+            shape_original.data(), num_vertices,
+            out_x.data(), out_y.data()
+        );
+        break;
+    }
+}
+
+// Triangulates a convex shape as an indexed fan over its own vertices, to be
+// added as a mesh for instanced drawing. The color is not used by instanced
+// drawing.
+inline auto build_mesh(
+    const std::vector< glm::vec2 >& shape_original
+) {
+    vk_util::IndexedMesh< Vertex > mesh;
+
+    const int num_vertices = shape_original.size();
+    if(num_vertices >= 3) {
+        mesh.vertices.reserve(num_vertices);
+        for(const auto& coord : shape_original) {
+            mesh.vertices.push_back({ coord, glm::vec3 { 1.0f, 1.0f, 1.0f } });
+        }
+
+        mesh.indices.reserve(3 * (num_vertices - 2));
+        for(int i = 1; i < num_vertices - 1; ++i) {
+            mesh.indices.insert(mesh.indices.end(), {
+                0,
+                static_cast< std::uint16_t >(i),
+                static_cast< std::uint16_t >(i + 1)
+            });
+        }
+    }
+
+    return mesh;
+}
+
+// Builds the per-instance data for drawing a mesh with the transform, which
+// is applied by the instanced vertex shader.
+inline auto make_instance_data(
+    const ShapeTransform& transform,
+    const glm::vec3&      color
+) {
+    InstanceData res;
+    res.rotation = transform.rotation;
+    res.scale    = { transform.scale[0], transform.scale[1] };
+    res.offset   = { transform.δ[0], transform.δ[1] };
+    res.position = { transform.position[0], transform.position[1] };
+    res.color    = color;
+    return res;
+}
+
 } // namespace pgw
 
 #endif
@@ -0,0 +1,369 @@
+#ifndef PGW_GAME_GEO_WARS_PARTICLE_HPP
+#define PGW_GAME_GEO_WARS_PARTICLE_HPP
+
+#include <algorithm> // clamp, min
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numbers>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include "utility/cpu-features.hpp"
+#include "visual/window.hpp"
+
+namespace pgw {
+
+// A thin quad along the x axis, drawn for every particle. Particles are
+// stretched along their direction of motion.
+inline const std::vector< glm::vec2 > shape_spark {
+    { 1.0f, 0.15f },
+    { -1.0f, 0.15f },
+    { -1.0f, -0.15f },
+    { 1.0f, -0.15f }
+};
+
+// The initial state of a new particle.
+struct ParticleDesc {
+    glm::vec2 position { 0.0f, 0.0f };
+    glm::vec2 velocity { 0.0f, 0.0f };
+    glm::vec3 color    { 1.0f, 1.0f, 1.0f };
+    float     life   = 1.0f; // In seconds
+    float     length = 0.01f; // Half length of the spark when fully alive
+};
+
+//-------------------------------------
+// Particle integration and fade kernels
+//-------------------------------------
+namespace particle_detail {
+
+// The fields changed by integration, in SoA layout.
+struct IntegrateFields {
+    float* x;
+    float* y;
+    float* vx;
+    float* vy;
+    float* life;
+};
+
+// Integrates particles in [begin, end). Velocities are damped before moving.
+inline void integrate_scalar(
+    const IntegrateFields& f,
+    std::size_t            begin,
+    std::size_t            end,
+    float                  dt,
+    float                  damping
+) {
+    for(std::size_t i = begin; i < end; ++i) {
+        f.vx[i] *= damping;
+        f.vy[i] *= damping;
+        f.x[i]  += f.vx[i] * dt;
+        f.y[i]  += f.vy[i] * dt;
+        f.life[i] -= dt;
+    }
+}
+
+#if PGW_SIMD_X86
+inline void integrate_sse2(
+    const IntegrateFields& f,
+    std::size_t            n,
+    float                  dt,
+    float                  damping
+) {
+    constexpr std::size_t width = 4;
+    const std::size_t num_full = n / width * width;
+
+    const auto vdt = _mm_set1_ps(dt);
+    const auto vdamping = _mm_set1_ps(damping);
+    for(std::size_t i = 0; i < num_full; i += width) {
+        const auto vx = _mm_mul_ps(_mm_loadu_ps(f.vx + i), vdamping);
+        const auto vy = _mm_mul_ps(_mm_loadu_ps(f.vy + i), vdamping);
+        _mm_storeu_ps(f.vx + i, vx);
+        _mm_storeu_ps(f.vy + i, vy);
+        _mm_storeu_ps(f.x + i, _mm_add_ps(_mm_loadu_ps(f.x + i), _mm_mul_ps(vx, vdt)));
+        _mm_storeu_ps(f.y + i, _mm_add_ps(_mm_loadu_ps(f.y + i), _mm_mul_ps(vy, vdt)));
+        _mm_storeu_ps(f.life + i, _mm_sub_ps(_mm_loadu_ps(f.life + i), vdt));
+    }
+
+    integrate_scalar(f, num_full, n, dt, damping);
+}
+
+PGW_TARGET_AVX2
+inline void integrate_avx2(
+    const IntegrateFields& f,
+    std::size_t            n,
+    float                  dt,
+    float                  damping
+) {
+    constexpr std::size_t width = 8;
+    const std::size_t num_full = n / width * width;
+
+    const auto vdt = _mm256_set1_ps(dt);
+    const auto vdamping = _mm256_set1_ps(damping);
+    for(std::size_t i = 0; i < num_full; i += width) {
+        const auto vx = _mm256_mul_ps(_mm256_loadu_ps(f.vx + i), vdamping);
+        const auto vy = _mm256_mul_ps(_mm256_loadu_ps(f.vy + i), vdamping);
+        _mm256_storeu_ps(f.vx + i, vx);
+        _mm256_storeu_ps(f.vy + i, vy);
+        _mm256_storeu_ps(f.x + i, _mm256_fmadd_ps(vx, vdt, _mm256_loadu_ps(f.x + i)));
+        _mm256_storeu_ps(f.y + i, _mm256_fmadd_ps(vy, vdt, _mm256_loadu_ps(f.y + i)));
+        _mm256_storeu_ps(f.life + i, _mm256_sub_ps(_mm256_loadu_ps(f.life + i), vdt));
+    }
+
+    integrate_scalar(f, num_full, n, dt, damping);
+}
+#endif
+
+// Computes the fade of particles in [begin, end), which is the remaining
+// fraction of their life.
+inline void fade_scalar(
+    const float* life,
+    const float* inv_max_life,
+    float*       alpha,
+    std::size_t  begin,
+    std::size_t  end
+) {
+    for(std::size_t i = begin; i < end; ++i) {
+        alpha[i] = std::clamp(life[i] * inv_max_life[i], 0.0f, 1.0f);
+    }
+}
+
+#if PGW_SIMD_X86
+inline void fade_sse2(
+    const float* life,
+    const float* inv_max_life,
+    float*       alpha,
+    std::size_t  n
+) {
+    constexpr std::size_t width = 4;
+    const std::size_t num_full = n / width * width;
+
+    const auto vzero = _mm_setzero_ps();
+    const auto vone = _mm_set1_ps(1.0f);
+    for(std::size_t i = 0; i < num_full; i += width) {
+        const auto a = _mm_mul_ps(_mm_loadu_ps(life + i), _mm_loadu_ps(inv_max_life + i));
+        _mm_storeu_ps(alpha + i, _mm_min_ps(_mm_max_ps(a, vzero), vone));
+    }
+
+    fade_scalar(life, inv_max_life, alpha, num_full, n);
+}
+
+PGW_TARGET_AVX2
+inline void fade_avx2(
+    const float* life,
+    const float* inv_max_life,
+    float*       alpha,
+    std::size_t  n
+) {
+    constexpr std::size_t width = 8;
+    const std::size_t num_full = n / width * width;
+
+    const auto vzero = _mm256_setzero_ps();
+    const auto vone = _mm256_set1_ps(1.0f);
+    for(std::size_t i = 0; i < num_full; i += width) {
+        const auto a = _mm256_mul_ps(_mm256_loadu_ps(life + i), _mm256_loadu_ps(inv_max_life + i));
+        _mm256_storeu_ps(alpha + i, _mm256_min_ps(_mm256_max_ps(a, vzero), vone));
+    }
+
+    fade_scalar(life, inv_max_life, alpha, num_full, n);
+}
+#endif
+
+} // namespace particle_detail
+
+//-------------------------------------
+// Particle pool
+//-------------------------------------
+
+// A fixed-capacity pool of short lived particles, such as explosion debris
+// and trails.
+//
+// Live particles are packed in [0, size()) of every field array, in SoA
+// layout. Expired particles are removed by moving the last particle into
+// their place, and new particles are appended, so the storage allocated on
+// construction is recycled forever. Emitting into a full pool drops the new
+// particles.
+//
+// Particles move in straight lines slowed down by drag, so their direction,
+// and the rotation of their sparks, is fixed on emission. They fade out
+// linearly over their life.
+class ParticlePool {
+public:
+    // drag is the rate of exponential decay of speed, per second.
+    explicit ParticlePool(std::size_t capacity, float drag = 2.0f) :
+        capacity_(capacity),
+        drag_(drag),
+        x_(capacity), y_(capacity),
+        vx_(capacity), vy_(capacity),
+        life_(capacity), inv_max_life_(capacity), alpha_(capacity),
+        rotation_(capacity), length_(capacity),
+        color_(capacity)
+    {}
+
+    // Returns false if the pool is full.
+    bool emit(const ParticleDesc& desc) {
+        if(size_ == capacity_) return false;
+        if(!(desc.life > 0)) {
+            throw std::runtime_error("Life of particle must be positive.");
+        }
+
+        const auto i = size_++;
+        x_[i]  = desc.position.x;
+        y_[i]  = desc.position.y;
+        vx_[i] = desc.velocity.x;
+        vy_[i] = desc.velocity.y;
+        life_[i] = desc.life;
+        inv_max_life_[i] = 1.0f / desc.life;
+        alpha_[i] = 1.0f;
+        rotation_[i] = std::atan2(desc.velocity.y, desc.velocity.x);
+        length_[i] = desc.length;
+        color_[i] = desc.color;
+        return true;
+    }
+
+    // Emits particles from one point in random directions, with speeds
+    // uniformly distributed in [min_speed, max_speed]. Returns the number of
+    // particles emitted.
+    std::size_t emit_burst(
+        const glm::vec2& position,
+        std::size_t      count,
+        float            min_speed,
+        float            max_speed,
+        const glm::vec3& color,
+        float            life,
+        float            length
+    ) {
+        if(!(life > 0)) {
+            throw std::runtime_error("Life of particle must be positive.");
+        }
+
+        std::uniform_real_distribution< float > angle_dist(0.0f, 2 * std::numbers::pi_v< float >);
+        std::uniform_real_distribution< float > speed_dist(min_speed, max_speed);
+
+        count = std::min(count, capacity_ - size_);
+        for(std::size_t k = 0; k < count; ++k) {
+            const auto angle = angle_dist(rng_);
+            const auto speed = speed_dist(rng_);
+
+            const auto i = size_++;
+            x_[i]  = position.x;
+            y_[i]  = position.y;
+            vx_[i] = speed * std::cos(angle);
+            vy_[i] = speed * std::sin(angle);
+            life_[i] = life;
+            inv_max_life_[i] = 1.0f / life;
+            alpha_[i] = 1.0f;
+            rotation_[i] = angle;
+            length_[i] = length;
+            color_[i] = color;
+        }
+        return count;
+    }
+
+    // Advances all particles by dt seconds, and recycles the expired ones.
+    void update(float dt) {
+        const particle_detail::IntegrateFields fields {
+            x_.data(), y_.data(), vx_.data(), vy_.data(), life_.data()
+        };
+        const float damping = std::exp(-drag_ * dt);
+
+        switch(simd_level()) {
+#if PGW_SIMD_X86
+        case SimdLevel::avx2:
+            particle_detail::integrate_avx2(fields, size_, dt, damping);
+            break;
+        case SimdLevel::sse2:
+            particle_detail::integrate_sse2(fields, size_, dt, damping);
+            break;
+#endif
+        default:
+            particle_detail::integrate_scalar(fields, 0, size_, dt, damping);
+            break;
+        }
+
+        // Fade with the remaining life
+        switch(simd_level()) {
+#if PGW_SIMD_X86
+        case SimdLevel::avx2:
+            particle_detail::fade_avx2(life_.data(), inv_max_life_.data(), alpha_.data(), size_);
+            break;
+        case SimdLevel::sse2:
+            particle_detail::fade_sse2(life_.data(), inv_max_life_.data(), alpha_.data(), size_);
+            break;
+#endif
+        default:
+            particle_detail::fade_scalar(life_.data(), inv_max_life_.data(), alpha_.data(), 0, size_);
+            break;
+        }
+
+        // Recycle expired particles
+        for(std::size_t i = 0; i < size_; ) {
+            if(life_[i] > 0) {
+                ++i;
+                continue;
+            }
+
+            const auto last = --size_;
+            x_[i]  = x_[last];
+            y_[i]  = y_[last];
+            vx_[i] = vx_[last];
+            vy_[i] = vy_[last];
+            life_[i] = life_[last];
+            inv_max_life_[i] = inv_max_life_[last];
+            alpha_[i] = alpha_[last];
+            rotation_[i] = rotation_[last];
+            length_[i] = length_[last];
+            color_[i] = color_[last];
+        }
+    }
+
+    // Writes the instance data of all live particles, to be drawn with the
+    // spark mesh. The output must have room for size() instances, and is
+    // typically a mapped upload region.
+    void write_instances(std::span< InstanceData > out) const {
+        if(out.size() < size_) {
+            throw std::runtime_error("Output of particle instances is too small.");
+        }
+
+        for(std::size_t i = 0; i < size_; ++i) {
+            const float alpha = alpha_[i];
+
+            auto& inst = out[i];
+            inst.rotation = rotation_[i];
+            inst.scale    = { length_[i] * (0.5f + 0.5f * alpha), length_[i] };
+            inst.offset   = { 0.0f, 0.0f };
+            inst.position = { x_[i], y_[i] };
+            inst.color    = color_[i] * alpha;
+        }
+    }
+
+    // Accessors
+    auto size() const { return size_; }
+    auto capacity() const { return capacity_; }
+
+private:
+    std::size_t capacity_;
+    std::size_t size_ = 0;
+    float       drag_;
+
+    std::minstd_rand rng_;
+
+    // Fields of live particles
+    std::vector< float >     x_, y_;
+    std::vector< float >     vx_, vy_;
+    std::vector< float >     life_; // Remaining, in seconds
+    std::vector< float >     inv_max_life_;
+    std::vector< float >     alpha_; // Fade, updated with life
+    std::vector< float >     rotation_;
+    std::vector< float >     length_;
+    std::vector< glm::vec3 > color_;
+};
+
+} // namespace pgw
+
+#endif
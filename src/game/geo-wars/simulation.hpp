@@ -0,0 +1,204 @@
+#ifndef PGW_GAME_GEO_WARS_SIMULATION_HPP
+#define PGW_GAME_GEO_WARS_SIMULATION_HPP
+
+#include <algorithm> // clamp
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <numbers>
+#include <stop_token>
+#include <thread>
+#include <utility> // move
+#include <vector>
+
+#include "game/geo-wars/entity.hpp"
+#include "game/geo-wars/object.hpp"
+#include "utility/triple-buffer.hpp"
+
+namespace pgw {
+
+// An immutable copy of the renderable state of the world after a tick.
+//
+// Both the state after the tick and the state before it are included, so that
+// the renderer can interpolate without having to see every snapshot.
+struct WorldSnapshot {
+    std::uint64_t tick = 0;
+    // The time at which the state after the tick is current
+    std::chrono::steady_clock::time_point tick_time;
+
+    std::vector< glm::vec2 >     prev_positions;
+    std::vector< glm::vec2 >     positions;
+    std::vector< float >         prev_rotations;
+    std::vector< float >         rotations;
+    std::vector< glm::vec2 >     scales;
+    std::vector< glm::vec3 >     colors;
+    std::vector< std::uint32_t > shapes;
+};
+
+// Runs the game simulation at a fixed time step on its own thread.
+//
+// The simulation owns the entity store. After each batch of ticks, it
+// publishes a WorldSnapshot through a triple buffer, which the render thread
+// reads without blocking the simulation.
+class Simulation {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // The step function advances the entities by dt seconds. It always runs
+    // on the simulation thread.
+    using StepFunction = std::function< void(EntityStore&, float dt) >;
+
+    constexpr static double default_tick_rate = 120.0;
+    // If the simulation falls further behind than this, the missing time is
+    // dropped instead of being caught up.
+    constexpr static auto max_catch_up = std::chrono::milliseconds(250);
+
+    explicit Simulation(double tick_rate = default_tick_rate) :
+        tick_duration_(std::chrono::duration_cast< Clock::duration >(std::chrono::duration< double >(1.0 / tick_rate))),
+        dt_(1.0 / tick_rate)
+    {}
+
+    ~Simulation() {
+        stop();
+    }
+
+    // The entities can only be accessed here while the simulation is not
+    // running.
+    auto& entities() { return entities_; }
+
+    void start(StepFunction step) {
+        thread_ = std::jthread(
+            [this, step = std::move(step)](std::stop_token st) {
+                run_(st, step);
+            }
+        );
+    }
+
+    void stop() {
+        if(thread_.joinable()) {
+            thread_.request_stop();
+            thread_.join();
+        }
+    }
+
+    // Render thread side
+    //---------------------------------
+
+    // Returns the latest published snapshot. The reference is valid until the
+    // next call.
+    const WorldSnapshot& latest_snapshot() {
+        snapshots_.update();
+        return snapshots_.front();
+    }
+
+    // The interpolation factor between the previous and the current state of
+    // the snapshot at the given time.
+    //
+    // Rendering lags the simulation by up to a tick, so that the displayed
+    // state is always between two simulated states.
+    float interpolation_alpha(const WorldSnapshot& snapshot, Clock::time_point now) const {
+        const auto elapsed = std::chrono::duration< double >(now - snapshot.tick_time).count();
+        return static_cast< float >(std::clamp(elapsed / dt_, 0.0, 1.0));
+    }
+
+    auto tick_duration() const { return tick_duration_; }
+
+private:
+    void run_(std::stop_token st, const StepFunction& step) {
+        auto last_tick_time = Clock::now();
+        publish_(last_tick_time);
+
+        while(!st.stop_requested()) {
+            const auto next_tick_time = last_tick_time + tick_duration_;
+            auto now = Clock::now();
+            if(now < next_tick_time) {
+                std::this_thread::sleep_until(next_tick_time);
+                continue;
+            }
+
+            if(now - last_tick_time > max_catch_up) {
+                last_tick_time = now - tick_duration_;
+            }
+
+            // Run all ticks that are due
+            while(now - last_tick_time >= tick_duration_) {
+                entities_.save_previous_state();
+                step(entities_, dt_);
+
+                ++tick_;
+                last_tick_time += tick_duration_;
+            }
+
+            publish_(last_tick_time);
+        }
+    }
+
+    void publish_(Clock::time_point tick_time) {
+        auto& snapshot = snapshots_.back();
+
+        snapshot.tick           = tick_;
+        snapshot.tick_time      = tick_time;
+        snapshot.prev_positions = entities_.prev_positions();
+        snapshot.positions      = entities_.positions();
+        snapshot.prev_rotations = entities_.prev_rotations();
+        snapshot.rotations      = entities_.rotations();
+        snapshot.scales         = entities_.scales();
+        snapshot.colors         = entities_.colors();
+        snapshot.shapes         = entities_.shapes();
+
+        snapshots_.publish();
+    }
+
+
+    // Owned by the simulation thread while running
+    EntityStore   entities_;
+    std::uint64_t tick_ = 0;
+
+    Clock::duration tick_duration_;
+    float           dt_; // In seconds
+
+    TripleBuffer< WorldSnapshot > snapshots_;
+
+    std::jthread thread_;
+};
+
+// Builds instance data from the snapshot, interpolating between the previous
+// and the current state by alpha in [0, 1].
+inline void build_instances(
+    const WorldSnapshot&          snapshot,
+    float                         alpha,
+    std::size_t                   num_shapes,
+    std::vector< InstanceData >&  instances,
+    std::vector< InstanceBatch >& batches,
+    std::vector< std::uint32_t >& scratch_counts
+) {
+    build_instances_by_shape(
+        snapshot.shapes,
+        num_shapes,
+        [&](std::uint32_t i) {
+            const auto& prev_pos = snapshot.prev_positions[i];
+            const auto& pos      = snapshot.positions[i];
+
+            // Interpolate rotation along the shorter arc
+            const auto prev_rot = snapshot.prev_rotations[i];
+            const auto drot = std::remainder(snapshot.rotations[i] - prev_rot, 2 * std::numbers::pi_v< float >);
+
+            ShapeTransform transform;
+            transform.rotation = prev_rot + alpha * drot;
+            transform.scale[0] = snapshot.scales[i].x;
+            transform.scale[1] = snapshot.scales[i].y;
+            transform.position[0] = prev_pos.x + alpha * (pos.x - prev_pos.x);
+            transform.position[1] = prev_pos.y + alpha * (pos.y - prev_pos.y);
+
+            return make_instance_data(transform, snapshot.colors[i]);
+        },
+        instances,
+        batches,
+        scratch_counts
+    );
+}
+
+} // namespace pgw
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef PGW_UTILITY_CPU_FEATURES_HPP
+#define PGW_UTILITY_CPU_FEATURES_HPP
+
+// This file provides runtime detection of SIMD instruction sets, so that
+// vectorized kernels can be selected on the machine they are running on.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #define PGW_SIMD_X86 1
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #endif
+#else
+    #define PGW_SIMD_X86 0
+#endif
+
+// Functions using AVX2 intrinsics must be marked with this for GCC and Clang.
+// MSVC allows the intrinsics without any annotation.
+#if PGW_SIMD_X86 && (defined(__GNUC__) || defined(__clang__))
+    #define PGW_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+    #define PGW_TARGET_AVX2
+#endif
+
+namespace pgw {
+
+enum class SimdLevel {
+    scalar,
+    sse2,
+    avx2      // With FMA
+};
+
+namespace cpu_features_detail {
+
+inline SimdLevel detect_simd_level() {
+#if PGW_SIMD_X86
+    #ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        const int max_leaf = info[0];
+
+        __cpuid(info, 1);
+        const bool sse2    = info[3] & (1 << 26);
+        const bool fma     = info[2] & (1 << 12);
+        const bool osxsave = info[2] & (1 << 27);
+        const bool avx     = info[2] & (1 << 28);
+
+        bool avx2 = false;
+        if(max_leaf >= 7) {
+            __cpuidex(info, 7, 0);
+            avx2 = info[1] & (1 << 5);
+        }
+
+        // The OS must also save the YMM registers
+        const bool ymm_enabled = osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+
+        if(avx2 && fma && ymm_enabled) return SimdLevel::avx2;
+        if(sse2) return SimdLevel::sse2;
+    #else
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SimdLevel::avx2;
+        if(__builtin_cpu_supports("sse2")) return SimdLevel::sse2;
+    #endif
+#endif
+    return SimdLevel::scalar;
+}
+
+} // namespace cpu_features_detail
+
+// The best SIMD level supported by the CPU, detected on first use.
+inline SimdLevel simd_level() {
+    static const SimdLevel level = cpu_features_detail::detect_simd_level();
+    return level;
+}
+
+} // namespace pgw
+
+#endif
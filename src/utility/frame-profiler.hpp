@@ -0,0 +1,190 @@
+#ifndef PGW_UTILITY_FRAME_PROFILER_HPP
+#define PGW_UTILITY_FRAME_PROFILER_HPP
+
+#include <algorithm> // max_element, nth_element
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+namespace pgw {
+
+// The timed stages of a frame on the render thread.
+enum class FrameStage : std::size_t {
+    poll_events,
+    fence_wait,       // Waiting for the in-flight fence of the frame
+    before_render,    // Game logic and uploads, including copy_vertex_data
+    copy_vertex_data,
+    acquire,          // Acquiring the swap chain image, and waiting for it
+    record,           // Recording the graphics command buffer
+    submit,
+    present,
+    frame,            // From the start of one frame to the start of the next
+    // GPU durations, measured with timestamp queries
+    gpu_upload,
+    gpu_render_pass,
+    gpu_frame,
+    count
+};
+
+inline constexpr std::array< const char*, static_cast< std::size_t >(FrameStage::count) > frame_stage_names {
+    "poll_events",
+    "fence_wait",
+    "before_render",
+    "copy_vertex_data",
+    "acquire",
+    "record",
+    "submit",
+    "present",
+    "frame",
+    "gpu_upload",
+    "gpu_render_pass",
+    "gpu_frame"
+};
+
+// Percentiles of the durations of a stage, in milliseconds.
+struct FrameStageStats {
+    std::size_t num_samples = 0;
+    double      p50 = 0;
+    double      p95 = 0;
+    double      p99 = 0;
+    double      max = 0;
+};
+
+// Measures the time of each stage of the latest frames.
+//
+// Each stage keeps the durations of its latest window_size samples in a ring,
+// so that the statistics follow the recent behavior of the game. Percentiles
+// and maxima, rather than averages, show the occasional long frames that are
+// seen as hitches. Statistics are computed on demand, which sorts a copy of
+// the window, so they should be queried about once per second, not per frame.
+//
+// GPU durations are recorded when their results are read back, so they lag
+// the CPU stages by the frames in flight.
+//
+// Not thread-safe: all stages must be timed on the same thread.
+class FrameProfiler {
+public:
+    using clock = std::chrono::steady_clock;
+
+    constexpr static std::size_t window_size = 1024;
+    constexpr static std::size_t num_stages  = static_cast< std::size_t >(FrameStage::count);
+
+    // Records the duration from construction to destruction into a stage.
+    class ScopedTimer {
+    public:
+        ScopedTimer(FrameProfiler& profiler, FrameStage stage) :
+            profiler_(profiler),
+            stage_(stage),
+            start_(clock::now())
+        {}
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+        ~ScopedTimer() {
+            profiler_.record(stage_, clock::now() - start_);
+        }
+
+    private:
+        FrameProfiler&    profiler_;
+        FrameStage        stage_;
+        clock::time_point start_;
+    };
+
+    FrameProfiler() {
+        for(auto& samples : samples_) samples.reserve(window_size);
+    }
+
+    [[nodiscard]] ScopedTimer scope(FrameStage stage) {
+        return ScopedTimer(*this, stage);
+    }
+
+    template< typename Rep, typename Period >
+    void record(FrameStage stage, std::chrono::duration< Rep, Period > duration) {
+        const auto s = static_cast< std::size_t >(stage);
+        const auto ns = std::chrono::duration_cast< std::chrono::nanoseconds >(duration).count();
+
+        auto& samples = samples_[s];
+        if(samples.size() < window_size) {
+            samples.push_back(ns);
+        } else {
+            samples[next_[s]] = ns;
+        }
+        next_[s] = (next_[s] + 1) % window_size;
+    }
+
+    // Marks the start of a frame, which ends the previous one.
+    void begin_frame() {
+        const auto now = clock::now();
+        if(frame_started_) record(FrameStage::frame, now - frame_start_);
+        frame_start_ = now;
+        frame_started_ = true;
+    }
+
+    FrameStageStats stats(FrameStage stage) const {
+        const auto& samples = samples_[static_cast< std::size_t >(stage)];
+
+        FrameStageStats res {};
+        res.num_samples = samples.size();
+        if(samples.empty()) return res;
+
+        scratch_.assign(samples.begin(), samples.end());
+        const auto percentile = [&](double p) {
+            // Nearest rank
+            const auto rank = static_cast< std::size_t >(p * (scratch_.size() - 1) + 0.5);
+            std::nth_element(scratch_.begin(), scratch_.begin() + rank, scratch_.end());
+            return to_ms_(scratch_[rank]);
+        };
+        res.p50 = percentile(0.50);
+        res.p95 = percentile(0.95);
+        res.p99 = percentile(0.99);
+        res.max = to_ms_(*std::max_element(samples.begin(), samples.end()));
+        return res;
+    }
+
+    // Prints the statistics of all stages with samples, one stage per line.
+    void report(std::ostream& os) const {
+        os << std::fixed << std::setprecision(3)
+            << std::left << std::setw(18) << "stage" << std::right
+            << std::setw(10) << "p50(ms)"
+            << std::setw(10) << "p95(ms)"
+            << std::setw(10) << "p99(ms)"
+            << std::setw(10) << "max(ms)" << '\n';
+        for(std::size_t s = 0; s < num_stages; ++s) {
+            const auto st = stats(static_cast< FrameStage >(s));
+            if(st.num_samples == 0) continue;
+
+            os << std::left << std::setw(18) << frame_stage_names[s] << std::right
+                << std::setw(10) << st.p50
+                << std::setw(10) << st.p95
+                << std::setw(10) << st.p99
+                << std::setw(10) << st.max << '\n';
+        }
+        os << std::defaultfloat;
+    }
+
+    void clear() {
+        for(auto& samples : samples_) samples.clear();
+        next_.fill(0);
+        frame_started_ = false;
+    }
+
+private:
+    static double to_ms_(std::int64_t ns) { return ns * 1e-6; }
+
+    // Durations in nanoseconds, in a ring starting at next_ once full
+    std::array< std::vector< std::int64_t >, num_stages > samples_;
+    std::array< std::size_t, num_stages >                 next_ {};
+
+    clock::time_point frame_start_;
+    bool              frame_started_ = false;
+
+    mutable std::vector< std::int64_t > scratch_;
+};
+
+} // namespace pgw
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef PGW_UTILITY_TRIPLE_BUFFER_HPP
+#define PGW_UTILITY_TRIPLE_BUFFER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+namespace pgw {
+
+// A lock-free triple buffer for passing the latest value from one producer
+// thread to one consumer thread.
+//
+// The producer fills back() and calls publish(). The consumer calls update()
+// and then reads front(). Neither side ever blocks, and the consumer always
+// sees the latest published value. Intermediate values may be skipped.
+//
+// After publish(), back() refers to a stale buffer previously seen by the
+// consumer, so the producer must overwrite all of it before publishing again.
+template< typename T >
+class TripleBuffer {
+public:
+
+    // Producer side
+    T& back() { return buffers_[back_]; }
+
+    void publish() {
+        back_ = middle_.exchange(back_ | dirty_bit_, std::memory_order_acq_rel) & index_mask_;
+    }
+
+    // Consumer side
+    //
+    // Returns whether a newly published value has been acquired.
+    bool update() {
+        if(!(middle_.load(std::memory_order_relaxed) & dirty_bit_)) return false;
+
+        front_ = middle_.exchange(front_, std::memory_order_acq_rel) & index_mask_;
+        return true;
+    }
+
+    const T& front() const { return buffers_[front_]; }
+
+private:
+    static constexpr std::uint8_t index_mask_ = 0x3;
+    static constexpr std::uint8_t dirty_bit_  = 0x4;
+
+    T buffers_[3] {};
+
+    std::uint8_t back_  = 0; // Owned by the producer
+    std::uint8_t front_ = 2; // Owned by the consumer
+    std::atomic< std::uint8_t > middle_ { 1 }; // Index and dirty bit
+};
+
+} // namespace pgw
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef PGW_UTILITY_WORKER_POOL_HPP
+#define PGW_UTILITY_WORKER_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pgw {
+
+// A fixed set of worker threads running the iterations of a loop in
+// parallel.
+//
+// parallel_for hands out the iterations one by one to the workers and to the
+// calling thread, and blocks until all of them have returned. Only one thread
+// may call parallel_for at a time. Workers sleep between calls.
+class WorkerPool {
+public:
+    explicit WorkerPool(std::size_t num_workers) {
+        workers_.reserve(num_workers);
+        for(std::size_t i = 0; i < num_workers; ++i) {
+            workers_.emplace_back([this] { run_worker_(); });
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard lk(mutex_);
+            stop_ = true;
+        }
+        start_cv_.notify_all();
+        // Workers are joined when destroyed
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Calls fn(i) for each i in [0, n). The first exception thrown by fn is
+    // rethrown after all iterations have returned.
+    template< typename Fn >
+    void parallel_for(std::size_t n, Fn&& fn) {
+        if(n == 0) return;
+        if(workers_.empty() || n == 1) {
+            for(std::size_t i = 0; i < n; ++i) fn(i);
+            return;
+        }
+
+        const std::function< void(std::size_t) > task(std::ref(fn));
+        {
+            std::lock_guard lk(mutex_);
+            p_task_ = &task;
+            task_size_ = n;
+            next_.store(0, std::memory_order_relaxed);
+            num_active_ = workers_.size();
+            error_ = nullptr;
+            ++generation_;
+        }
+        start_cv_.notify_all();
+
+        run_task_();
+
+        std::unique_lock lk(mutex_);
+        done_cv_.wait(lk, [this] { return num_active_ == 0; });
+        p_task_ = nullptr;
+        if(error_) std::rethrow_exception(error_);
+    }
+
+    auto num_workers() const { return workers_.size(); }
+
+private:
+    void run_worker_() {
+        std::uint64_t seen_generation = 0;
+        while(true) {
+            {
+                std::unique_lock lk(mutex_);
+                start_cv_.wait(lk, [&] { return stop_ || generation_ != seen_generation; });
+                if(stop_) return;
+                seen_generation = generation_;
+            }
+
+            run_task_();
+
+            {
+                std::lock_guard lk(mutex_);
+                if(--num_active_ == 0) done_cv_.notify_one();
+            }
+        }
+    }
+
+    void run_task_() {
+        for(
+            auto i = next_.fetch_add(1, std::memory_order_relaxed);
+            i < task_size_;
+            i = next_.fetch_add(1, std::memory_order_relaxed)
+        ) {
+            try {
+                (*p_task_)(i);
+            } catch(...) {
+                std::lock_guard lk(mutex_);
+                if(!error_) error_ = std::current_exception();
+            }
+        }
+    }
+
+
+    std::mutex              mutex_;
+    std::condition_variable start_cv_;
+    std::condition_variable done_cv_;
+
+    // The current loop, published under the mutex with a new generation
+    const std::function< void(std::size_t) >* p_task_ = nullptr;
+    std::size_t                task_size_ = 0;
+    std::atomic< std::size_t > next_ { 0 };
+    std::size_t                num_active_ = 0; // Workers still in the loop
+    std::uint64_t              generation_ = 0;
+    std::exception_ptr         error_;
+    bool                       stop_ = false;
+
+    // Last, so that workers are joined before the rest is destroyed
+    std::vector< std::jthread > workers_;
+};
+
+} // namespace pgw
+
+#endif
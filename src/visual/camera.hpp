@@ -0,0 +1,80 @@
+#ifndef PGW_VISUAL_CAMERA_HPP
+#define PGW_VISUAL_CAMERA_HPP
+
+#include <algorithm> // max
+#include <cmath>
+#include <random>
+
+#include <glm/vec2.hpp>
+
+#include "visual/vk-utils.hpp"
+
+namespace pgw {
+
+// A 2D camera over the world, applied by the vertex shaders, so that moving
+// it uploads no vertex or instance data.
+struct Camera {
+    glm::vec2 position { 0.0f, 0.0f }; // World position at the center of the screen
+    float     rotation = 0;            // Counterclockwise, in radians
+    float     zoom = 1.0f;             // Clip space units per world unit
+    glm::vec2 shake { 0.0f, 0.0f };    // Offset in clip space, after the zoom
+
+    // The view matrix rotates the world by -rotation around the camera
+    // position.
+    auto uniforms() const {
+        const float c = std::cos(rotation);
+        const float s = std::sin(rotation);
+
+        vk_util::CameraUniforms res;
+        res.view[0][0] = c;
+        res.view[0][1] = -s;
+        res.view[1][0] = s;
+        res.view[1][1] = c;
+        res.view[3][0] = -(c * position.x + s * position.y);
+        res.view[3][1] = s * position.x - c * position.y;
+        res.shake = shake;
+        res.zoom = zoom;
+        return res;
+    }
+};
+
+// Random camera offsets of decaying amplitude, such as after an explosion.
+class ScreenShake {
+public:
+    // Starts shaking, unless a stronger shake is already going on. The
+    // amplitude is in clip space, and decays linearly to zero over the
+    // duration.
+    void start(float amplitude, float duration) {
+        if(amplitude >= current_amplitude_()) {
+            amplitude_ = amplitude;
+            duration_ = duration;
+            remaining_ = duration;
+        }
+    }
+
+    // Advances the shake, and returns the offset for the frame.
+    glm::vec2 update(float dt) {
+        remaining_ = std::max(remaining_ - dt, 0.0f);
+
+        const float a = current_amplitude_();
+        if(a == 0) return { 0.0f, 0.0f };
+
+        std::uniform_real_distribution< float > dist(-a, a);
+        return { dist(rng_), dist(rng_) };
+    }
+
+private:
+    float current_amplitude_() const {
+        return remaining_ > 0 ? amplitude_ * remaining_ / duration_ : 0.0f;
+    }
+
+    float amplitude_ = 0;
+    float duration_ = 0;
+    float remaining_ = 0;
+
+    std::minstd_rand rng_;
+};
+
+} // namespace pgw
+
+#endif
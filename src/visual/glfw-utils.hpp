@@ -3,6 +3,7 @@
 
 #include <cstddef>
 #include <functional>
+#include <stdexcept>
 
 #include "visual-common.hpp"
 
@@ -23,7 +24,9 @@ public:
 
 private:
     static void init_() {
-        if(env_counter_ == 0) glfwInit();
+        if(env_counter_ == 0 && glfwInit() != GLFW_TRUE) {
+            throw std::runtime_error("Failed to initialize GLFW.");
+        }
         ++env_counter_;
     }
     static void destroy_() {
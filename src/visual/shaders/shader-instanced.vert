@@ -0,0 +1,38 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Per-vertex mesh data, float or half float, see DeviceVertexLayout
+layout(location = 0) in vec2 in_position;
+
+// Per-instance transform, same as ShapeTransform
+layout(location = 1) in float in_rotation;
+layout(location = 2) in vec2 in_scale;
+layout(location = 3) in vec2 in_offset;
+layout(location = 4) in vec2 in_world_position;
+layout(location = 5) in vec3 in_color;
+
+layout(location = 0) out vec3 fragColor;
+
+// Camera, same as CameraUniforms
+layout(set = 0, binding = 0) uniform Camera {
+    mat4  view;
+    vec2  shake; // In clip space
+    float zoom;
+} camera;
+
+vec4 world_to_clip(vec2 p) {
+    return vec4(camera.zoom * (camera.view * vec4(p, 0.0, 1.0)).xy + camera.shake, 0.0, 1.0);
+}
+
+void main() {
+    // Same as transform_matrix: offset, scale, rotate, then place in world
+    const vec2 p = (in_position + in_offset) * in_scale;
+    const float c = cos(in_rotation);
+    const float s = sin(in_rotation);
+
+    gl_Position = world_to_clip(vec2(
+        c * p.x - s * p.y + in_world_position.x,
+        s * p.x + c * p.y + in_world_position.y
+    ));
+    fragColor = in_color;
+}
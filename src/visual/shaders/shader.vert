@@ -1,12 +1,25 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// Either float or packed (half float, 8-bit color) vertices, see
+// DeviceVertexLayout
 layout(location = 0) in vec2 in_position;
 layout(location = 1) in vec3 in_color;
 
 layout(location = 0) out vec3 fragColor;
 
+// Camera, same as CameraUniforms
+layout(set = 0, binding = 0) uniform Camera {
+    mat4  view;
+    vec2  shake; // In clip space
+    float zoom;
+} camera;
+
+vec4 world_to_clip(vec2 p) {
+    return vec4(camera.zoom * (camera.view * vec4(p, 0.0, 1.0)).xy + camera.shake, 0.0, 1.0);
+}
+
 void main() {
-    gl_Position = vec4(in_position, 0.0, 1.0);
+    gl_Position = world_to_clip(in_position);
     fragColor = in_color;
 }
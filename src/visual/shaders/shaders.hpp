@@ -11,11 +11,21 @@ namespace vertex_shader {
 const std::vector< unsigned char > shader(std::begin(value), std::end(value));
 } // namespace vertex_shader
 
+namespace instanced_vertex_shader {
+#include "shader-instanced.vert.spv.hpp"
+const std::vector< unsigned char > shader(std::begin(value), std::end(value));
+} // namespace instanced_vertex_shader
+
 namespace fragment_shader {
 #include "shader.frag.spv.hpp"
 const std::vector< unsigned char > shader(std::begin(value), std::end(value));
 } // namespace fragment_shader
 
+namespace particle_compute_shader {
+#include "particle.comp.spv.hpp"
+const std::vector< unsigned char > shader(std::begin(value), std::end(value));
+} // namespace particle_compute_shader
+
 } // namespace pgw
 
 #endif
@@ -23,6 +23,9 @@ constexpr bool visual_debug = true;
 constexpr const char* window_title = "Geometry Wars";
 constexpr const char* app_name     = "GeoWars";
 
+// Pipeline cache file, relative to the working directory
+constexpr const char* pipeline_cache_file = "geowars-pipeline-cache.bin";
+
 // Validation layer
 inline const std::vector< const char* > default_validation_layers {
     "VK_LAYER_KHRONOS_validation"
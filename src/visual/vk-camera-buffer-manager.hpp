@@ -0,0 +1,74 @@
+#ifndef PGW_VISUAL_VK_CAMERA_BUFFER_MANAGER_HPP
+#define PGW_VISUAL_VK_CAMERA_BUFFER_MANAGER_HPP
+
+#include <cstring> // memcpy
+#include <vector>
+
+#include "visual/vk-utils.hpp"
+
+namespace pgw {
+namespace vk_util {
+
+// Keeps the camera of each frame in flight in a uniform buffer.
+class CameraBufferManager {
+public:
+    CameraBufferManager(
+        MemoryAllocator& allocator,
+        VkDevice         device,
+        std::size_t      num_frames
+    ) :
+        allocator_(allocator),
+        device_(device),
+        buffers_(num_frames),
+        memories_(num_frames)
+    {
+        for(std::size_t i = 0; i < num_frames; ++i) {
+            std::tie(buffers_[i], memories_[i]) = create_buffer(
+                allocator_,
+                sizeof(CameraUniforms),
+                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+            );
+            write(i, {});
+        }
+
+        set_layout_ = create_uniform_buffer_set_layout(device_, VK_SHADER_STAGE_VERTEX_BIT);
+        std::tie(descriptor_pool_, descriptor_sets_) = create_uniform_buffer_sets(device_, set_layout_, buffers_);
+    }
+
+    ~CameraBufferManager() {
+        vkDestroyDescriptorPool(device_, descriptor_pool_, nullptr);
+        vkDestroyDescriptorSetLayout(device_, set_layout_, nullptr);
+
+        for(std::size_t i = 0; i < buffers_.size(); ++i) {
+            destroy_buffer(allocator_, buffers_[i], memories_[i]);
+        }
+    }
+
+    // Sets the camera of the frame.
+    void write(std::size_t frame, const CameraUniforms& camera) {
+        std::memcpy(memories_[frame].p_mapped, &camera, sizeof(camera));
+    }
+
+    // Accessors
+    auto set_layout() const { return set_layout_; }
+    auto descriptor_set(std::size_t frame) const { return descriptor_sets_[frame]; }
+
+private:
+    // The environment (not changed)
+    MemoryAllocator& allocator_;
+    VkDevice         device_;
+
+    // One uniform buffer per frame
+    std::vector< VkBuffer >         buffers_;
+    std::vector< MemoryAllocation > memories_;
+
+    VkDescriptorSetLayout          set_layout_;
+    VkDescriptorPool               descriptor_pool_;
+    std::vector< VkDescriptorSet > descriptor_sets_;
+};
+
+} // namespace vk_util
+} // namespace pgw
+
+#endif
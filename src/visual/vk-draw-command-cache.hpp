@@ -0,0 +1,174 @@
+#ifndef PGW_VISUAL_VK_DRAW_COMMAND_CACHE_HPP
+#define PGW_VISUAL_VK_DRAW_COMMAND_CACHE_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "utility/worker-pool.hpp"
+#include "visual/vk-utils.hpp"
+
+namespace pgw {
+namespace vk_util {
+
+// Everything recorded into the draw commands of a layer of a frame.
+struct DrawState {
+    VkExtent2D   swap_chain_extent {};
+    VkRenderPass render_pass = VK_NULL_HANDLE;
+    VkPipelineLayout pipeline_layout = VK_NULL_HANDLE;
+    VkDescriptorSet  camera_set = VK_NULL_HANDLE;
+    // Plain vertices
+    VkPipeline   vertex_pipeline = VK_NULL_HANDLE;
+    VkBuffer     vertex_buffer = VK_NULL_HANDLE;
+    VkDeviceSize vertex_buffer_offset = 0;
+    std::size_t  num_vertices = 0;
+    // Instanced meshes
+    VkPipeline   instanced_pipeline = VK_NULL_HANDLE;
+    VkBuffer     mesh_buffer = VK_NULL_HANDLE;
+    VkBuffer     mesh_index_buffer = VK_NULL_HANDLE;
+    std::vector< InstanceBufferDraws > instanced_draws;
+
+    bool operator==(const DrawState& other) const {
+        return swap_chain_extent.width  == other.swap_chain_extent.width
+            && swap_chain_extent.height == other.swap_chain_extent.height
+            && render_pass          == other.render_pass
+            && pipeline_layout      == other.pipeline_layout
+            && camera_set           == other.camera_set
+            && vertex_pipeline      == other.vertex_pipeline
+            && vertex_buffer        == other.vertex_buffer
+            && vertex_buffer_offset == other.vertex_buffer_offset
+            && num_vertices         == other.num_vertices
+            && instanced_pipeline   == other.instanced_pipeline
+            && mesh_buffer          == other.mesh_buffer
+            && mesh_index_buffer    == other.mesh_index_buffer
+            && instanced_draws      == other.instanced_draws;
+    }
+};
+
+// Caches the secondary command buffers of the draw layers of each frame.
+// invalidate must be called whenever a buffer, the render pass or a pipeline
+// is recreated.
+class DrawCommandCache {
+public:
+    DrawCommandCache(
+        VkDevice                  device,
+        const QueueFamilyIndices& qf_indices,
+        std::size_t               num_frames,
+        // Besides the calling thread
+        std::size_t               num_worker_threads = 0
+    ) :
+        device_(device),
+        qf_indices_(qf_indices),
+        frames_(num_frames),
+        workers_(num_worker_threads)
+    {}
+
+    ~DrawCommandCache() {
+        for(auto& f : frames_) {
+            for(auto& layer : f.layers) {
+                vkDestroyCommandPool(device_, layer.command_pool, nullptr);
+            }
+        }
+    }
+
+    // Returns the draw commands of the layers for the frame, recording the
+    // layers whose state differs from the one last recorded for the frame.
+    const std::vector< VkCommandBuffer >& command_buffers(
+        std::size_t                     frame,
+        const std::vector< DrawState >& layer_states
+    ) {
+        auto& f = frames_[frame];
+
+        // Command pools are created on this thread, the first time a layer
+        // is used
+        while(f.layers.size() < layer_states.size()) {
+            auto& layer = f.layers.emplace_back();
+            layer.command_pool = create_graphics_command_pool(device_, qf_indices_, 0);
+            layer.command_buffer = allocate_command_buffers(
+                device_, layer.command_pool, 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY
+            )[0];
+        }
+
+        changed_layers_.clear();
+        for(std::size_t i = 0; i < layer_states.size(); ++i) {
+            const auto& layer = f.layers[i];
+            if(!layer.valid || layer.state != layer_states[i]) {
+                changed_layers_.push_back(i);
+            }
+        }
+
+        workers_.parallel_for(changed_layers_.size(), [&](std::size_t c) {
+            const auto i = changed_layers_[c];
+            auto& layer = f.layers[i];
+            const auto& state = layer_states[i];
+
+            layer.valid = false;
+            vkResetCommandPool(device_, layer.command_pool, 0);
+            record_secondary_draw_command_buffer(
+                state.swap_chain_extent,
+                state.render_pass,
+                layer.command_buffer,
+                state.pipeline_layout,
+                state.camera_set,
+                state.vertex_pipeline,
+                state.vertex_buffer,
+                state.vertex_buffer_offset,
+                state.num_vertices,
+                state.instanced_pipeline,
+                state.mesh_buffer,
+                state.mesh_index_buffer,
+                state.instanced_draws
+            );
+            layer.state = state;
+            layer.valid = true;
+        });
+        num_recordings_ += changed_layers_.size();
+
+        command_buffers_.clear();
+        for(std::size_t i = 0; i < layer_states.size(); ++i) {
+            command_buffers_.push_back(f.layers[i].command_buffer);
+        }
+        return command_buffers_;
+    }
+
+    // Forces all layers of all frames to be recorded again.
+    void invalidate() {
+        for(auto& f : frames_) {
+            for(auto& layer : f.layers) layer.valid = false;
+        }
+    }
+
+    // Accessors
+    // Number of layers recorded so far
+    auto num_recordings() const { return num_recordings_; }
+    auto num_worker_threads() const { return workers_.num_workers(); }
+
+private:
+    struct LayerCommands {
+        VkCommandPool   command_pool;
+        VkCommandBuffer command_buffer;
+        DrawState       state;
+        bool            valid = false;
+    };
+    struct FrameCommands {
+        std::vector< LayerCommands > layers;
+    };
+
+
+    // The environment (not changed)
+    VkDevice           device_;
+    QueueFamilyIndices qf_indices_;
+
+    std::vector< FrameCommands > frames_;
+    std::uint64_t num_recordings_ = 0;
+
+    // Scratch
+    std::vector< std::size_t >     changed_layers_;
+    std::vector< VkCommandBuffer > command_buffers_;
+
+    WorkerPool workers_;
+};
+
+} // namespace vk_util
+} // namespace pgw
+
+#endif
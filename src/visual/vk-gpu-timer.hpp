@@ -0,0 +1,223 @@
+#ifndef PGW_VISUAL_VK_GPU_TIMER_HPP
+#define PGW_VISUAL_VK_GPU_TIMER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "visual/vk-utils.hpp"
+
+namespace pgw {
+namespace vk_util {
+
+// GPU durations of the work of one frame.
+struct GpuFrameTimes {
+    using duration = std::chrono::duration< double, std::nano >;
+
+    duration upload {};      // Sum of the transfers of the frame
+    duration render_pass {};
+    duration frame {};       // The graphics commands, from start to the end of the render pass
+};
+
+// Measures the graphics commands and the uploads of each frame with timestamp
+// queries.
+class GpuFrameTimer {
+public:
+    constexpr static std::uint32_t num_graphics_queries = 3;
+    // More uploads in a frame are not measured
+    constexpr static std::uint32_t max_uploads = 4;
+    constexpr static std::uint32_t queries_per_frame = num_graphics_queries + 2 * max_uploads;
+
+    GpuFrameTimer(
+        VkPhysicalDevice          phys_dev,
+        MemoryAllocator&          allocator,
+        const QueueFamilyIndices& qf_indices,
+        std::size_t               num_frames
+    ) :
+        allocator_(allocator),
+        device_(allocator.device()),
+        num_frames_(num_frames),
+        frame_states_(num_frames)
+    {
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(phys_dev, &props);
+        timestamp_period_ = props.limits.timestampPeriod;
+
+        std::uint32_t qf_count = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(phys_dev, &qf_count, nullptr);
+        std::vector< VkQueueFamilyProperties > qf(qf_count);
+        vkGetPhysicalDeviceQueueFamilyProperties(phys_dev, &qf_count, qf.data());
+
+        graphics_valid_bits_ = qf[qf_indices.graphics_family.value()].timestampValidBits;
+        transfer_valid_bits_ = qf[qf_indices.transfer_family.value()].timestampValidBits;
+        if(graphics_valid_bits_ == 0) return;
+
+        query_pool_ = create_timestamp_query_pool(device_, queries_per_frame * num_frames_);
+
+        std::tie(
+            result_buffer_,
+            result_memory_
+        ) = create_buffer(
+            allocator_,
+            result_size_per_frame_ * num_frames_,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+        );
+        p_result_data_ = result_memory_.p_mapped;
+    }
+
+    ~GpuFrameTimer() {
+        if(!enabled()) return;
+
+        destroy_buffer(allocator_, result_buffer_, result_memory_);
+        vkDestroyQueryPool(device_, query_pool_, nullptr);
+    }
+
+    // Reads the results of the previous use of the frame, and starts a new
+    // use.
+    std::optional< GpuFrameTimes > begin_frame(std::size_t frame) {
+        auto& st = frame_states_[frame];
+
+        std::optional< GpuFrameTimes > res;
+        if(st.resolved) {
+            res = read_results_(frame, st.num_uploads);
+        } else if(st.num_uploads > 0) {
+            // Upload queries may have been written without being reset, if
+            // the frame was skipped
+            st.uploads_reset = false;
+        }
+
+        st.num_uploads = 0;
+        st.resolved = false;
+        return res;
+    }
+
+    // Queries for the next upload of the frame, if it can be measured.
+    std::optional< TimestampQueries > upload_queries(std::size_t frame) {
+        auto& st = frame_states_[frame];
+        if(!enabled() || transfer_valid_bits_ == 0 || !st.uploads_reset || st.num_uploads == max_uploads) {
+            return std::nullopt;
+        }
+
+        return TimestampQueries {
+            query_pool_,
+            first_query_(frame) + num_graphics_queries + 2 * st.num_uploads++
+        };
+    }
+
+    // Queries for the graphics command buffer of the frame, if it can be
+    // measured.
+    std::optional< TimestampQueries > graphics_queries(std::size_t frame) const {
+        if(!enabled()) return std::nullopt;
+        return TimestampQueries { query_pool_, first_query_(frame) };
+    }
+
+    // Records the copy of the results of the frame, after the render pass of
+    // its graphics command buffer.
+    void record_resolve(VkCommandBuffer command_buffer, std::size_t frame) {
+        if(!enabled()) return;
+
+        auto& st = frame_states_[frame];
+        const auto first = first_query_(frame);
+        const auto offset = result_size_per_frame_ * frame;
+
+        // Graphics queries are written in this command buffer
+        vkCmdCopyQueryPoolResults(
+            command_buffer, query_pool_,
+            first, num_graphics_queries,
+            result_buffer_, offset, sizeof(std::uint64_t),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT
+        );
+        // Upload queries handed out may not have been written, and are read
+        // with availability instead of being waited for
+        if(st.num_uploads > 0) {
+            vkCmdCopyQueryPoolResults(
+                command_buffer, query_pool_,
+                first + num_graphics_queries, 2 * st.num_uploads,
+                result_buffer_, offset + graphics_result_size_, 2 * sizeof(std::uint64_t),
+                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+            );
+        }
+        vkCmdResetQueryPool(command_buffer, query_pool_, first + num_graphics_queries, 2 * max_uploads);
+
+        VkMemoryBarrier barrier {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr
+        );
+
+        st.resolved = true;
+        st.uploads_reset = true;
+    }
+
+    bool enabled() const { return query_pool_ != VK_NULL_HANDLE; }
+
+private:
+    struct FrameState {
+        std::uint32_t num_uploads = 0;
+        bool          resolved = false;
+        // Upload queries are reset at the end of each graphics command buffer
+        bool          uploads_reset = false;
+    };
+
+    // Graphics results, then upload results with availability
+    constexpr static VkDeviceSize graphics_result_size_ = num_graphics_queries * sizeof(std::uint64_t);
+    constexpr static VkDeviceSize result_size_per_frame_ = graphics_result_size_ + 2 * max_uploads * 2 * sizeof(std::uint64_t);
+
+    std::uint32_t first_query_(std::size_t frame) const {
+        return static_cast< std::uint32_t >(frame) * queries_per_frame;
+    }
+
+    GpuFrameTimes::duration ticks_to_duration_(std::uint64_t begin, std::uint64_t end, std::uint32_t valid_bits) const {
+        const std::uint64_t mask = valid_bits >= 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << valid_bits) - 1;
+        return GpuFrameTimes::duration(((end - begin) & mask) * static_cast< double >(timestamp_period_));
+    }
+
+    GpuFrameTimes read_results_(std::size_t frame, std::uint32_t num_uploads) const {
+        const auto p = reinterpret_cast< const std::uint64_t* >(
+            static_cast< const char* >(p_result_data_) + result_size_per_frame_ * frame
+        );
+
+        GpuFrameTimes res {};
+        res.frame       = ticks_to_duration_(p[0], p[2], graphics_valid_bits_);
+        res.render_pass = ticks_to_duration_(p[1], p[2], graphics_valid_bits_);
+
+        // Each upload query is a value followed by its availability
+        const auto pu = p + num_graphics_queries;
+        for(std::uint32_t i = 0; i < num_uploads; ++i) {
+            const auto begin = pu + 4 * i;
+            const auto end   = begin + 2;
+            if(begin[1] && end[1]) {
+                res.upload += ticks_to_duration_(begin[0], end[0], transfer_valid_bits_);
+            }
+        }
+        return res;
+    }
+
+
+    // The environment (not changed)
+    MemoryAllocator& allocator_;
+    VkDevice    device_;
+    std::size_t num_frames_;
+
+    float         timestamp_period_ = 1; // Nanoseconds per tick
+    std::uint32_t graphics_valid_bits_ = 0;
+    std::uint32_t transfer_valid_bits_ = 0;
+
+    VkQueryPool    query_pool_ = VK_NULL_HANDLE;
+    VkBuffer       result_buffer_ = VK_NULL_HANDLE;
+    MemoryAllocation result_memory_;
+    void*          p_result_data_ = nullptr; // Persistently mapped
+
+    std::vector< FrameState > frame_states_;
+};
+
+} // namespace vk_util
+} // namespace pgw
+
+#endif
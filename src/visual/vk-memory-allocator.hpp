@@ -0,0 +1,294 @@
+#ifndef PGW_VISUAL_VK_MEMORY_ALLOCATOR_HPP
+#define PGW_VISUAL_VK_MEMORY_ALLOCATOR_HPP
+
+#include <algorithm> // find_if, max, min
+#include <array>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+#include "visual-common.hpp"
+
+namespace pgw {
+namespace vk_util {
+
+// A range of device memory, sub-allocated from a block.
+struct MemoryAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize   offset = 0;
+    VkDeviceSize   size = 0;
+    // The start of the range, if the memory is host visible
+    void*          p_mapped = nullptr;
+
+    // The pool of the block
+    std::uint32_t  memory_type = 0;
+    bool           linear = true;
+};
+
+struct MemoryStats {
+    std::size_t  num_blocks = 0;      // Live vkAllocateMemory allocations
+    std::size_t  num_allocations = 0;
+    VkDeviceSize block_bytes = 0;     // Total size of the blocks
+    VkDeviceSize allocated_bytes = 0; // Total size of the allocations
+};
+
+// Sub-allocates buffers and images from large blocks of device memory, with
+// separate pools for linear and optimal tiling resources. Host visible blocks
+// are mapped once and stay mapped until freed, so their allocations are
+// accessed through p_mapped and never mapped again. Not thread-safe.
+class MemoryAllocator {
+public:
+    constexpr static VkDeviceSize default_block_size = VkDeviceSize(64) << 20;
+
+    MemoryAllocator(
+        VkPhysicalDevice phys_dev,
+        VkDevice         device,
+        VkDeviceSize     block_size = default_block_size
+    ) :
+        device_(device),
+        block_size_(block_size)
+    {
+        vkGetPhysicalDeviceMemoryProperties(phys_dev, &mem_props_);
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(phys_dev, &props);
+        max_num_blocks_ = props.limits.maxMemoryAllocationCount;
+        non_coherent_atom_size_ = props.limits.nonCoherentAtomSize;
+    }
+
+    ~MemoryAllocator() {
+        for(auto& pool : pools_) {
+            for(auto& p_block : pool) {
+                destroy_block_(*p_block);
+            }
+        }
+    }
+
+    MemoryAllocator(const MemoryAllocator&) = delete;
+    MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+    // Allocates memory with the requirements, in a memory type having all
+    // the properties. Linear is false for images with optimal tiling.
+    MemoryAllocation allocate(
+        const VkMemoryRequirements& mem_req,
+        VkMemoryPropertyFlags       prop_f,
+        bool                        linear = true
+    ) {
+        const auto memory_type = find_memory_type(mem_req.memoryTypeBits, prop_f);
+        const bool host_visible = mem_props_.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+
+        // Host visible ranges are kept atom aligned, so that they can be
+        // flushed on their own if the memory is not coherent
+        auto alignment = std::max< VkDeviceSize >(mem_req.alignment, 1);
+        auto size = mem_req.size;
+        if(host_visible) {
+            alignment = std::max(alignment, non_coherent_atom_size_);
+            size = align_up_(size, non_coherent_atom_size_);
+        }
+
+        auto& pool = pools_[pool_index_(memory_type, linear)];
+        const auto block_size = pool_block_size_(memory_type);
+
+        // Dedicated block
+        if(size > block_size / 2) {
+            auto& block = create_block_(pool, memory_type, size, true);
+            return take_(block, block.free_ranges.begin(), 0, size, memory_type, linear);
+        }
+
+        for(auto& p_block : pool) {
+            if(p_block->dedicated) continue;
+            for(auto it = p_block->free_ranges.begin(); it != p_block->free_ranges.end(); ++it) {
+                const auto aligned = align_up_(it->first, alignment);
+                if(aligned + size <= it->first + it->second) {
+                    return take_(*p_block, it, aligned, size, memory_type, linear);
+                }
+            }
+        }
+
+        auto& block = create_block_(pool, memory_type, block_size, false);
+        return take_(block, block.free_ranges.begin(), 0, size, memory_type, linear);
+    }
+
+    void free(const MemoryAllocation& allocation) {
+        if(allocation.memory == VK_NULL_HANDLE) return;
+
+        auto& pool = pools_[pool_index_(allocation.memory_type, allocation.linear)];
+        const auto block_it = std::find_if(pool.begin(), pool.end(), [&](const auto& p_block) {
+            return p_block->memory == allocation.memory;
+        });
+        if(block_it == pool.end()) {
+            throw std::runtime_error("Failed to find the memory block of an allocation.");
+        }
+        auto& block = **block_it;
+
+        // Insert the range, and merge it with the adjacent free ranges
+        auto [it, inserted] = block.free_ranges.emplace(allocation.offset, allocation.size);
+        if(const auto next = std::next(it); next != block.free_ranges.end() && it->first + it->second == next->first) {
+            it->second += next->second;
+            block.free_ranges.erase(next);
+        }
+        if(it != block.free_ranges.begin()) {
+            if(const auto prev = std::prev(it); prev->first + prev->second == it->first) {
+                prev->second += it->second;
+                block.free_ranges.erase(it);
+            }
+        }
+
+        --block.num_allocations;
+        --stats_.num_allocations;
+        stats_.allocated_bytes -= allocation.size;
+
+        if(block.num_allocations == 0) {
+            const bool last_shared = !block.dedicated && std::none_of(pool.begin(), pool.end(), [&](const auto& p_block) {
+                return p_block.get() != &block && !p_block->dedicated;
+            });
+            if(!last_shared) {
+                destroy_block_(block);
+                pool.erase(block_it);
+            }
+        }
+    }
+
+    std::uint32_t find_memory_type(std::uint32_t type_filter, VkMemoryPropertyFlags prop_f) const {
+        if(const auto res = find_memory_type_(type_filter, prop_f)) return *res;
+
+        throw std::runtime_error("Failed to find a suitable memory type.");
+    }
+    // Whether a memory type in the filter has all the properties, such as
+    // memory both device local and host visible.
+    bool has_memory_type(std::uint32_t type_filter, VkMemoryPropertyFlags prop_f) const {
+        return find_memory_type_(type_filter, prop_f).has_value();
+    }
+
+    // Accessors
+    auto device() const { return device_; }
+    const auto& stats() const { return stats_; }
+    const auto& memory_properties() const { return mem_props_; }
+
+private:
+    struct Block {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize   size = 0;
+        void*          p_mapped = nullptr;
+        bool           dedicated = false;
+
+        std::map< VkDeviceSize, VkDeviceSize > free_ranges; // Offset to size
+        std::size_t    num_allocations = 0;
+    };
+    using Pool = std::vector< std::unique_ptr< Block > >;
+
+    std::optional< std::uint32_t > find_memory_type_(std::uint32_t type_filter, VkMemoryPropertyFlags prop_f) const {
+        for(std::uint32_t i = 0; i < mem_props_.memoryTypeCount; ++i) {
+            if(type_filter & (1 << i) && (mem_props_.memoryTypes[i].propertyFlags & prop_f) == prop_f) {
+                return i;
+            }
+        }
+        return std::nullopt;
+    }
+
+    static VkDeviceSize align_up_(VkDeviceSize x, VkDeviceSize alignment) {
+        return alignment > 1 ? (x + alignment - 1) / alignment * alignment : x;
+    }
+
+    static std::size_t pool_index_(std::uint32_t memory_type, bool linear) {
+        return 2 * memory_type + (linear ? 0 : 1);
+    }
+
+    // Small heaps, such as device local host visible ones, get smaller blocks
+    VkDeviceSize pool_block_size_(std::uint32_t memory_type) const {
+        const auto heap_size = mem_props_.memoryHeaps[mem_props_.memoryTypes[memory_type].heapIndex].size;
+        return std::min(block_size_, std::max< VkDeviceSize >(heap_size / 8, 1));
+    }
+
+    Block& create_block_(Pool& pool, std::uint32_t memory_type, VkDeviceSize size, bool dedicated) {
+        if(max_num_blocks_ && stats_.num_blocks >= max_num_blocks_) {
+            throw std::runtime_error("Failed to allocate memory block: too many device memory allocations.");
+        }
+
+        auto p_block = std::make_unique< Block >();
+        p_block->size = size;
+        p_block->dedicated = dedicated;
+        p_block->free_ranges.emplace(0, size);
+
+        VkMemoryAllocateInfo alloc_info {};
+        alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        alloc_info.allocationSize = size;
+        alloc_info.memoryTypeIndex = memory_type;
+
+        if(vkAllocateMemory(device_, &alloc_info, nullptr, &p_block->memory) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate memory block.");
+        }
+        if(mem_props_.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+            if(vkMapMemory(device_, p_block->memory, 0, VK_WHOLE_SIZE, 0, &p_block->p_mapped) != VK_SUCCESS) {
+                vkFreeMemory(device_, p_block->memory, nullptr);
+                throw std::runtime_error("Failed to map memory block.");
+            }
+        }
+
+        ++stats_.num_blocks;
+        stats_.block_bytes += size;
+
+        pool.push_back(std::move(p_block));
+        return *pool.back();
+    }
+
+    void destroy_block_(Block& block) {
+        if(block.p_mapped) vkUnmapMemory(device_, block.memory);
+        vkFreeMemory(device_, block.memory, nullptr);
+
+        --stats_.num_blocks;
+        stats_.block_bytes -= block.size;
+    }
+
+    // Allocates [offset, offset + size) from the free range at it, which
+    // must contain it.
+    MemoryAllocation take_(
+        Block& block,
+        std::map< VkDeviceSize, VkDeviceSize >::iterator it,
+        VkDeviceSize  offset,
+        VkDeviceSize  size,
+        std::uint32_t memory_type,
+        bool          linear
+    ) {
+        const auto range_offset = it->first;
+        const auto range_end    = it->first + it->second;
+        block.free_ranges.erase(it);
+
+        // The alignment padding and the rest stay free
+        if(offset > range_offset) block.free_ranges.emplace(range_offset, offset - range_offset);
+        if(offset + size < range_end) block.free_ranges.emplace(offset + size, range_end - offset - size);
+
+        ++block.num_allocations;
+        ++stats_.num_allocations;
+        stats_.allocated_bytes += size;
+
+        MemoryAllocation res;
+        res.memory = block.memory;
+        res.offset = offset;
+        res.size = size;
+        res.p_mapped = block.p_mapped ? static_cast< char* >(block.p_mapped) + offset : nullptr;
+        res.memory_type = memory_type;
+        res.linear = linear;
+        return res;
+    }
+
+
+    // The environment (not changed)
+    VkDevice     device_;
+    VkDeviceSize block_size_;
+    VkPhysicalDeviceMemoryProperties mem_props_;
+    std::uint32_t max_num_blocks_ = 0;
+    VkDeviceSize  non_coherent_atom_size_ = 1;
+
+    std::array< Pool, 2 * VK_MAX_MEMORY_TYPES > pools_;
+    MemoryStats stats_;
+};
+
+} // namespace vk_util
+} // namespace pgw
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef PGW_VISUAL_VK_MESH_BUFFER_MANAGER_HPP
+#define PGW_VISUAL_VK_MESH_BUFFER_MANAGER_HPP
+
+#include <cstdint>
+#include <cstring> // memcpy
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "visual/vk-utils.hpp"
+
+namespace pgw {
+namespace vk_util {
+
+// A mesh as unique vertices and a triangle list of 16-bit indices into them.
+template< typename Vertex >
+struct IndexedMesh {
+    std::vector< Vertex >        vertices;
+    std::vector< std::uint16_t > indices;
+};
+
+// Converts a triangle list into an indexed mesh, merging vertices that are
+// equal byte for byte.
+template< typename Vertex >
+inline auto make_indexed_mesh(const std::vector< Vertex >& triangle_list) {
+    static_assert(std::is_trivially_copyable_v< Vertex >);
+
+    IndexedMesh< Vertex > res;
+    // Keys view the bytes of the unique vertices, which never move
+    res.vertices.reserve(triangle_list.size());
+    res.indices.reserve(triangle_list.size());
+
+    std::unordered_map< std::string_view, std::uint16_t > index_of;
+    for(const auto& v : triangle_list) {
+        const std::string_view bytes(reinterpret_cast< const char* >(&v), sizeof(Vertex));
+        if(const auto it = index_of.find(bytes); it != index_of.end()) {
+            res.indices.push_back(it->second);
+            continue;
+        }
+
+        if(res.vertices.size() > std::numeric_limits< std::uint16_t >::max()) {
+            throw std::runtime_error("Failed to index mesh: too many unique vertices.");
+        }
+        const auto index = static_cast< std::uint16_t >(res.vertices.size());
+        res.vertices.push_back(v);
+        index_of.emplace(
+            std::string_view(reinterpret_cast< const char* >(&res.vertices.back()), sizeof(Vertex)),
+            index
+        );
+        res.indices.push_back(index);
+    }
+
+    return res;
+}
+
+// Manages device local buffers holding static indexed meshes, with 16-bit
+// indices local to each mesh.
+template< typename Vertex >
+class MeshBufferManager {
+public:
+
+    // The location of a mesh in the buffers
+    struct MeshRange {
+        std::uint32_t first_index = 0;
+        std::uint32_t num_indices = 0;
+        std::int32_t  vertex_offset = 0;
+    };
+
+    MeshBufferManager(
+        MemoryAllocator& allocator,
+        VkDevice         device,
+        const QueueFamilyIndices& qf_indices,
+        VkCommandPool    command_pool,
+        VkQueue          transfer_queue
+    ) :
+        allocator_(allocator),
+        device_(device),
+        command_pool_(command_pool),
+        transfer_queue_(transfer_queue),
+        queue_families_(transfer_graphics_families(qf_indices))
+    {}
+
+    ~MeshBufferManager() {
+        destroy_buffers_();
+    }
+
+    // Adds an indexed mesh, and returns the index of the mesh. The mesh must
+    // not be empty, since there would be nothing to draw, and the buffers of
+    // a first empty mesh could not be created.
+    std::uint32_t add_mesh(const IndexedMesh< Vertex >& mesh) {
+        if(mesh.indices.empty()) {
+            throw std::runtime_error("Failed to add mesh: the mesh is empty.");
+        }
+
+        MeshRange range;
+        range.first_index = indices_.size();
+        range.num_indices = mesh.indices.size();
+        range.vertex_offset = vertices_.size();
+
+        vertices_.insert(vertices_.end(), mesh.vertices.begin(), mesh.vertices.end());
+        indices_.insert(indices_.end(), mesh.indices.begin(), mesh.indices.end());
+        meshes_.push_back(range);
+
+        upload_();
+
+        return meshes_.size() - 1;
+    }
+    // Adds a mesh given as a triangle list, and returns the index of the
+    // mesh.
+    std::uint32_t add_mesh(const std::vector< Vertex >& triangle_list) {
+        return add_mesh(make_indexed_mesh(triangle_list));
+    }
+
+    // Accessors
+    const auto& meshes() const { return meshes_; }
+    auto buffer() const { return buffer_; }
+    auto index_buffer() const { return index_buffer_; }
+
+private:
+
+    void upload_() {
+        // The old buffers might still be used by frames in flight
+        vkDeviceWaitIdle(device_);
+        destroy_buffers_();
+
+        std::tie(buffer_, memory_) = upload_buffer_(
+            vertices_.data(),
+            vertices_.size() * sizeof(Vertex),
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+        );
+        std::tie(index_buffer_, index_memory_) = upload_buffer_(
+            indices_.data(),
+            indices_.size() * sizeof(std::uint16_t),
+            VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+        );
+    }
+
+    // Creates a device local buffer with the data, through a staging buffer.
+    std::tuple< VkBuffer, MemoryAllocation > upload_buffer_(
+        const void*        p_data,
+        VkDeviceSize       size,
+        VkBufferUsageFlags usage_f
+    ) {
+        // Prepare staging buffer
+        const auto [staging_buffer, staging_memory] = create_buffer(
+            allocator_,
+            size,
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+        );
+        std::memcpy(staging_memory.p_mapped, p_data, size);
+
+        const auto res = create_buffer(
+            allocator_,
+            size,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage_f,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            // Written on the transfer queue, drawn on the graphics queue
+            queue_families_
+        );
+
+        copy_buffer(
+            device_,
+            command_pool_,
+            transfer_queue_,
+            staging_buffer,
+            std::get< 0 >(res),
+            0,
+            0,
+            size
+        );
+
+        destroy_buffer(allocator_, staging_buffer, staging_memory);
+        return res;
+    }
+
+    void destroy_buffers_() {
+        if(buffer_ != VK_NULL_HANDLE) {
+            destroy_buffer(allocator_, buffer_, memory_);
+            destroy_buffer(allocator_, index_buffer_, index_memory_);
+            buffer_ = VK_NULL_HANDLE;
+            index_buffer_ = VK_NULL_HANDLE;
+            memory_ = {};
+            index_memory_ = {};
+        }
+    }
+
+
+    // The environment (not changed)
+    MemoryAllocator& allocator_;
+    VkDevice         device_;
+    VkCommandPool    command_pool_; // Used for buffer copying
+    VkQueue          transfer_queue_; // Used for buffer copying
+    std::vector< std::uint32_t > queue_families_; // Sharing the mesh buffers
+
+    // The device mesh buffers
+    VkBuffer         buffer_ = VK_NULL_HANDLE;
+    MemoryAllocation memory_;
+    VkBuffer         index_buffer_ = VK_NULL_HANDLE;
+    MemoryAllocation index_memory_;
+
+    // Host copy of all meshes
+    std::vector< Vertex >        vertices_;
+    std::vector< std::uint16_t > indices_;
+    std::vector< MeshRange >     meshes_;
+};
+
+} // namespace vk_util
+} // namespace pgw
+
+#endif
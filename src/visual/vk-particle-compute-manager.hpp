@@ -0,0 +1,295 @@
+#ifndef PGW_VISUAL_VK_PARTICLE_COMPUTE_MANAGER_HPP
+#define PGW_VISUAL_VK_PARTICLE_COMPUTE_MANAGER_HPP
+
+#include <algorithm> // min
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include "visual/vk-utils.hpp"
+
+namespace pgw {
+namespace vk_util {
+
+// A burst of particles emitted from one point in random directions.
+struct ParticleBurst {
+    glm::vec2     origin { 0.0f, 0.0f };
+    float         min_speed = 0.1f;
+    float         max_speed = 1.0f;
+    glm::vec3     color { 1.0f, 1.0f, 1.0f };
+    float         life = 1.0f; // In seconds
+    float         length = 0.01f;
+    std::uint32_t count = 0;
+};
+
+// Simulates particles with a compute shader, and draws the live ones with an
+// indirect draw. The graphics queue must support compute.
+class ParticleComputeManager {
+public:
+    // Size of the particle struct in the compute shader (std430)
+    constexpr static VkDeviceSize particle_size = 48;
+    // Size of the instance data written for each particle
+    constexpr static VkDeviceSize instance_size = 10 * sizeof(float);
+    constexpr static std::uint32_t workgroup_size = 64;
+
+    // Same layout as the push constants of the compute shader
+    struct PushConstants {
+        glm::vec2     origin;
+        glm::vec2     speed_range;
+        glm::vec3     color;
+        float         life;
+        float         dt;
+        float         damping;
+        float         length;
+        std::uint32_t first;
+        std::uint32_t count;
+        std::uint32_t capacity;
+        std::uint32_t seed;
+        std::uint32_t mode;
+    };
+    static_assert(offsetof(PushConstants, dt) == 32 && sizeof(PushConstants) == 64);
+
+    // Each particle is drawn with the mesh at first_index in the index
+    // buffer. drag is the rate of exponential decay of speed, per second.
+    ParticleComputeManager(
+        MemoryAllocator& allocator,
+        VkDevice         device,
+        VkPipelineCache  pipeline_cache,
+        std::uint32_t    capacity,
+        std::uint32_t    first_index,
+        std::uint32_t    num_indices,
+        std::int32_t     vertex_offset,
+        float            drag = 2.0f
+    ) :
+        allocator_(allocator),
+        device_(device),
+        capacity_(capacity),
+        drag_(drag),
+        draw_command_ { num_indices, 0, first_index, vertex_offset, 0 }
+    {
+        if(capacity == 0) {
+            throw std::runtime_error("Capacity of particle compute must be positive.");
+        }
+
+        std::tie(particle_buffer_, particle_memory_) = create_buffer(
+            allocator,
+            capacity_ * particle_size,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+        );
+        std::tie(instance_buffer_, instance_memory_) = create_buffer(
+            allocator,
+            capacity_ * instance_size,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+        );
+        std::tie(indirect_buffer_, indirect_memory_) = create_buffer(
+            allocator,
+            sizeof(VkDrawIndexedIndirectCommand),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+        );
+
+        set_layout_ = create_storage_buffer_set_layout(device_, 3, VK_SHADER_STAGE_COMPUTE_BIT);
+        std::tie(descriptor_pool_, descriptor_set_) = create_storage_buffer_set(
+            device_,
+            set_layout_,
+            { particle_buffer_, instance_buffer_, indirect_buffer_ }
+        );
+        std::tie(pipeline_layout_, pipeline_) = create_compute_pipeline(
+            device_,
+            particle_compute_shader::shader,
+            set_layout_,
+            sizeof(PushConstants),
+            pipeline_cache
+        );
+    }
+
+    ~ParticleComputeManager() {
+        vkDestroyPipeline(device_, pipeline_, nullptr);
+        vkDestroyPipelineLayout(device_, pipeline_layout_, nullptr);
+        vkDestroyDescriptorPool(device_, descriptor_pool_, nullptr);
+        vkDestroyDescriptorSetLayout(device_, set_layout_, nullptr);
+
+        destroy_buffer(allocator_, indirect_buffer_, indirect_memory_);
+        destroy_buffer(allocator_, instance_buffer_, instance_memory_);
+        destroy_buffer(allocator_, particle_buffer_, particle_memory_);
+    }
+
+    // Queues a burst to be emitted in the next recorded frame.
+    void emit(const ParticleBurst& burst) {
+        if(burst.count == 0) return;
+        if(!(burst.life > 0)) {
+            throw std::runtime_error("Life of particle must be positive.");
+        }
+        pending_bursts_.push_back(burst);
+    }
+
+    // Adds time to simulate in the next recorded frame.
+    void advance(float dt) { pending_dt_ += dt; }
+
+    // Records the simulation of the pending time and bursts, outside of any
+    // render pass. Afterwards, the instance buffer is ready for vertex input,
+    // and the indirect buffer for an indirect draw.
+    void record(VkCommandBuffer command_buffer) {
+        if(!initialized_) {
+            // Zero life marks all slots as dead
+            vkCmdFillBuffer(command_buffer, particle_buffer_, 0, VK_WHOLE_SIZE, 0);
+            initialized_ = true;
+        } else {
+            // Previous frames must be done reading the instances and the
+            // draw command
+            memory_barrier_(
+                command_buffer,
+                VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0,
+                VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0
+            );
+        }
+
+        // The live particles are counted again from zero instances
+        vkCmdUpdateBuffer(command_buffer, indirect_buffer_, 0, sizeof(draw_command_), &draw_command_);
+        memory_barrier_(
+            command_buffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+        );
+
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
+        vkCmdBindDescriptorSets(
+            command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout_,
+            0, 1, &descriptor_set_, 0, nullptr
+        );
+
+        // Update all slots
+        {
+            PushConstants pc {};
+            pc.dt       = pending_dt_;
+            pc.damping  = std::exp(-drag_ * pending_dt_);
+            pc.first    = 0;
+            pc.count    = capacity_;
+            pc.capacity = capacity_;
+            pc.mode     = 0;
+            dispatch_(command_buffer, pc);
+        }
+
+        // Emit bursts into the next slots of the ring
+        for(const auto& burst : pending_bursts_) {
+            memory_barrier_(
+                command_buffer,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+            );
+
+            PushConstants pc {};
+            pc.origin      = burst.origin;
+            pc.speed_range = { burst.min_speed, burst.max_speed };
+            pc.color       = burst.color;
+            pc.life        = burst.life;
+            pc.length      = burst.length;
+            pc.first       = next_slot_;
+            pc.count       = std::min(burst.count, capacity_);
+            pc.capacity    = capacity_;
+            pc.seed        = next_seed_++ * 0x9E3779B9u;
+            pc.mode        = 1;
+            dispatch_(command_buffer, pc);
+
+            next_slot_ = (next_slot_ + pc.count) % capacity_;
+        }
+
+        // Write the instances of the live slots
+        {
+            memory_barrier_(
+                command_buffer,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+            );
+
+            PushConstants pc {};
+            pc.first    = 0;
+            pc.count    = capacity_;
+            pc.capacity = capacity_;
+            pc.mode     = 2;
+            dispatch_(command_buffer, pc);
+        }
+
+        memory_barrier_(
+            command_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+            VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT
+        );
+
+        pending_dt_ = 0;
+        pending_bursts_.clear();
+    }
+
+    // Accessors
+    auto capacity() const { return capacity_; }
+    auto instance_buffer() const { return instance_buffer_; }
+    // Holds one VkDrawIndexedIndirectCommand drawing the live particles
+    auto indirect_buffer() const { return indirect_buffer_; }
+
+private:
+
+    void dispatch_(VkCommandBuffer command_buffer, const PushConstants& pc) {
+        vkCmdPushConstants(
+            command_buffer, pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT,
+            0, sizeof(PushConstants), &pc
+        );
+        vkCmdDispatch(command_buffer, (pc.count + workgroup_size - 1) / workgroup_size, 1, 1);
+    }
+
+    static void memory_barrier_(
+        VkCommandBuffer      command_buffer,
+        VkPipelineStageFlags src_stage,
+        VkAccessFlags        src_access,
+        VkPipelineStageFlags dst_stage,
+        VkAccessFlags        dst_access
+    ) {
+        VkMemoryBarrier barrier {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = src_access;
+        barrier.dstAccessMask = dst_access;
+        vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+
+    // The environment (not changed)
+    MemoryAllocator& allocator_;
+    VkDevice      device_;
+    std::uint32_t capacity_;
+    float         drag_;
+    VkDrawIndexedIndirectCommand draw_command_; // Without instances
+
+    // Device buffers
+    VkBuffer         particle_buffer_;
+    MemoryAllocation particle_memory_;
+    VkBuffer         instance_buffer_;
+    MemoryAllocation instance_memory_;
+    VkBuffer         indirect_buffer_;
+    MemoryAllocation indirect_memory_;
+
+    // Compute pipeline
+    VkDescriptorSetLayout set_layout_;
+    VkDescriptorPool      descriptor_pool_;
+    VkDescriptorSet       descriptor_set_;
+    VkPipelineLayout      pipeline_layout_;
+    VkPipeline            pipeline_;
+
+    // States
+    bool          initialized_ = false;
+    std::uint32_t next_slot_ = 0;
+    std::uint32_t next_seed_ = 1;
+    float         pending_dt_ = 0;
+    std::vector< ParticleBurst > pending_bursts_;
+};
+
+} // namespace vk_util
+} // namespace pgw
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef PGW_VISUAL_VK_PIPELINE_CACHE_MANAGER_HPP
+#define PGW_VISUAL_VK_PIPELINE_CACHE_MANAGER_HPP
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "visual/vk-utils.hpp"
+
+namespace pgw {
+namespace vk_util {
+
+// Manages a pipeline cache that persists across runs in a file.
+class PipelineCacheManager {
+public:
+    PipelineCacheManager(
+        VkPhysicalDevice      phys_dev,
+        VkDevice              device,
+        std::filesystem::path path
+    ) :
+        device_(device),
+        path_(std::move(path))
+    {
+        auto data = read_file_(path_);
+        loaded_ = !data.empty() && is_pipeline_cache_data_compatible(phys_dev, data);
+        if(!loaded_) data.clear();
+
+        pipeline_cache_ = create_pipeline_cache(device_, data);
+    }
+
+    ~PipelineCacheManager() {
+        // Failing to save only makes the next start slower
+        try {
+            save();
+        } catch(const std::runtime_error&) {}
+
+        vkDestroyPipelineCache(device_, pipeline_cache_, nullptr);
+    }
+
+    // Writes the cache to the file. Returns whether it succeeded.
+    bool save() const {
+        const auto data = get_pipeline_cache_data(device_, pipeline_cache_);
+
+        auto tmp_path = path_;
+        tmp_path += ".tmp";
+        {
+            std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+            ofs.write(reinterpret_cast< const char* >(data.data()), data.size());
+            if(!ofs) return false;
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmp_path, path_, ec);
+        return !ec;
+    }
+
+    // Accessors
+    auto pipeline_cache() const { return pipeline_cache_; }
+    // Whether valid data was loaded from the file
+    bool loaded() const { return loaded_; }
+
+private:
+    static std::vector< unsigned char > read_file_(const std::filesystem::path& path) {
+        std::ifstream ifs(path, std::ios::binary);
+        if(!ifs) return {};
+
+        return std::vector< unsigned char >(
+            std::istreambuf_iterator< char >(ifs),
+            std::istreambuf_iterator< char >()
+        );
+    }
+
+
+    // The environment (not changed)
+    VkDevice              device_;
+    std::filesystem::path path_;
+
+    VkPipelineCache pipeline_cache_;
+    bool            loaded_ = false;
+};
+
+} // namespace vk_util
+} // namespace pgw
+
+#endif
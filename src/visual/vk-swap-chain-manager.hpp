@@ -1,135 +1,236 @@
 #ifndef PGW_VISUAL_VK_SWAP_CHAIN_MANAGER_HPP
 #define PGW_VISUAL_VK_SWAP_CHAIN_MANAGER_HPP
 
+#include <deque>
+
 #include "vk-utils.hpp"
 
 namespace pgw {
 namespace vk_util {
 
+// Manages the swap chain, or offscreen images if headless, and the render
+// pass and pipelines drawing into them.
 class SwapChainManager {
 public:
+    // Offscreen images are created in this format and rendered in turns.
+    constexpr static VkFormat      offscreen_image_format = VK_FORMAT_B8G8R8A8_UNORM;
+    constexpr static std::uint32_t num_offscreen_images   = 3;
+
     SwapChainManager(
         VkPhysicalDevice phys_dev,
         VkSurfaceKHR     surface,
         const QueueFamilyIndices& qf_indices,
         VkDevice         device,
+        MemoryAllocator& allocator, // For offscreen images
+        VkPipelineCache  pipeline_cache,
         int              width,
         int              height,
-        VkVertexInputBindingDescription bind_desc,
-        const std::vector< VkVertexInputAttributeDescription >& attr_desc
+        const std::vector< GraphicsPipelineDesc >& pipeline_descs
     ) :
         phys_dev_(phys_dev),
         surface_(surface),
         qf_indices_(qf_indices),
-        device_(device)
+        device_(device),
+        allocator_(allocator),
+        pipeline_cache_(pipeline_cache)
     {
-        init_(
-            width,
-            height,
-            bind_desc,
-            attr_desc
-        );
+        init_images_(width, height, VK_NULL_HANDLE);
+        init_pipelines_(pipeline_descs);
+        init_image_objects_();
     }
 
+    // The device must be idle.
     ~SwapChainManager() {
-        destroy_();
+        release_all_retired_();
+        destroy_images_(images_);
+        destroy_pipelines_();
     }
 
+    // Recreates the images with a new size. The objects of the old images
+    // are retired until num_frames_in_flight calls of release_retired.
+    //
+    // The render pass and the pipelines are kept, unless the image format
+    // changed, in which case the device is waited for and they are rebuilt.
     void recreate(
         int width,
         int height,
-        VkVertexInputBindingDescription bind_desc,
-        const std::vector< VkVertexInputAttributeDescription >& attr_desc
+        const std::vector< GraphicsPipelineDesc >& pipeline_descs,
+        std::size_t num_frames_in_flight
     ) {
-        vkDeviceWaitIdle(device_);
-
-        destroy_();
-        init_(
-            width,
-            height,
-            bind_desc,
-            attr_desc
-        );
+        const auto old_format = images_.format;
+        retired_.push_back({ std::move(images_), num_frames_in_flight });
+        images_ = {};
+
+        init_images_(width, height, retired_.back().images.swap_chain);
+
+        if(images_.format != old_format) {
+            vkDeviceWaitIdle(device_);
+            release_all_retired_();
+
+            destroy_pipelines_();
+            init_pipelines_(pipeline_descs);
+        }
+
+        init_image_objects_();
+    }
+
+    // Destroys the retired objects that are no longer used. Call once per
+    // frame, after waiting for the in-flight fence of the frame.
+    void release_retired() {
+        for(auto& retired : retired_) {
+            if(retired.frames_left > 0) --retired.frames_left;
+        }
+        while(!retired_.empty() && retired_.front().frames_left == 0) {
+            destroy_images_(retired_.front().images);
+            retired_.pop_front();
+        }
     }
 
 
     // Accessors
-    auto num_images() const { return swap_chain_images_.size(); }
-    auto swap_chain() const { return swap_chain_; }
-    auto swap_chain_extent() const { return swap_chain_extent_; }
+    bool headless() const { return surface_ == VK_NULL_HANDLE; }
+    auto num_images() const { return images_.images.size(); }
+    // VK_NULL_HANDLE if headless
+    auto swap_chain() const { return images_.swap_chain; }
+    auto swap_chain_extent() const { return images_.extent; }
 
     auto render_pass() const { return render_pass_; }
-    auto graphics_pipeline() const { return graphics_pipeline_; }
+    // Graphics pipelines, in the same order as the pipeline descriptions
+    const auto& graphics_pipelines() const { return graphics_pipelines_; }
+    const auto& pipeline_layouts() const { return pipeline_layouts_; }
 
-    const auto& framebuffers() const { return framebuffers_; }
-    const auto& command_pools() const { return command_pools_; }
-    const auto& command_buffers() const { return command_buffers_; }
+    const auto& framebuffers() const { return images_.framebuffers; }
+    const auto& command_pools() const { return images_.command_pools; }
+    const auto& command_buffers() const { return images_.command_buffers; }
 
 private:
-    void init_(
-        int width,
-        int height,
-        VkVertexInputBindingDescription bind_desc,
-        const std::vector< VkVertexInputAttributeDescription >& attr_desc
-    ) {
+    // The images and the objects depending on one set of images.
+    struct ImageObjects {
+        VkSwapchainKHR     swap_chain = VK_NULL_HANDLE;
+        std::vector< VkImage > images;
+        std::vector< MemoryAllocation > offscreen_memories; // Only if headless
+        VkFormat           format {};
+        VkExtent2D         extent {};
 
-        std::tie(
-            swap_chain_,
-            swap_chain_images_,
-            swap_chain_image_format_,
-            swap_chain_extent_
-        ) = vk_util::create_swap_chain(phys_dev_, surface_, device_, width, height);
-        swap_chain_image_views_ = vk_util::create_image_views(
+        std::vector< VkImageView > image_views;
+        std::vector< VkFramebuffer > framebuffers;
+
+        std::vector< VkCommandPool > command_pools;
+        std::vector< VkCommandBuffer > command_buffers;
+    };
+    struct RetiredImageObjects {
+        ImageObjects images;
+        std::size_t  frames_left; // Until it is no longer in use
+    };
+
+    void init_images_(int width, int height, VkSwapchainKHR old_swap_chain) {
+        if(headless()) {
+            images_.swap_chain = VK_NULL_HANDLE;
+            images_.format = offscreen_image_format;
+            images_.extent = {
+                static_cast< std::uint32_t >(width),
+                static_cast< std::uint32_t >(height)
+            };
+            std::tie(
+                images_.images,
+                images_.offscreen_memories
+            ) = vk_util::create_offscreen_images(
+                allocator_,
+                num_offscreen_images,
+                images_.format,
+                images_.extent
+            );
+        } else {
+            std::tie(
+                images_.swap_chain,
+                images_.images,
+                images_.format,
+                images_.extent
+            ) = vk_util::create_swap_chain(phys_dev_, surface_, device_, width, height, old_swap_chain);
+        }
+    }
+
+    void init_pipelines_(const std::vector< GraphicsPipelineDesc >& pipeline_descs) {
+        // Offscreen images are left ready to be copied out
+        render_pass_ = vk_util::create_render_pass(
             device_,
-            swap_chain_images_,
-            swap_chain_image_format_
+            images_.format,
+            headless() ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
         );
+        pipeline_layouts_.resize(pipeline_descs.size());
+        graphics_pipelines_.resize(pipeline_descs.size());
+        for(std::size_t i = 0; i < pipeline_descs.size(); ++i) {
+            std::tie(
+                pipeline_layouts_[i],
+                graphics_pipelines_[i]
+            ) = vk_util::create_graphics_pipeline(
+                device_,
+                render_pass_,
+                pipeline_descs[i],
+                pipeline_cache_
+            );
+        }
+    }
 
-        render_pass_ = vk_util::create_render_pass(device_, swap_chain_image_format_);
-        std::tie(
-            pipeline_layout_,
-            graphics_pipeline_
-        ) = vk_util::create_graphics_pipeline(
+    // Requires the images and the render pass.
+    void init_image_objects_() {
+        images_.image_views = vk_util::create_image_views(
             device_,
-            swap_chain_extent_,
-            render_pass_,
-            bind_desc,
-            attr_desc
+            images_.images,
+            images_.format
         );
 
-        framebuffers_ = vk_util::create_framebuffers(
+        images_.framebuffers = vk_util::create_framebuffers(
             device_,
-            swap_chain_image_views_,
-            swap_chain_extent_,
+            images_.image_views,
+            images_.extent,
             render_pass_
         );
 
         std::tie(
-            command_pools_,
-            command_buffers_
+            images_.command_pools,
+            images_.command_buffers
         ) = vk_util::create_graphics_command_pools_and_buffers(
             device_,
             qf_indices_,
-            framebuffers_
+            images_.framebuffers
         );
     }
 
-    void destroy_() {
-        for(auto command_pool : command_pools_) {
+    void destroy_images_(ImageObjects& objs) {
+        for(auto command_pool : objs.command_pools) {
             vkDestroyCommandPool(device_, command_pool, nullptr);
         }
-
-        for(auto framebuffer : framebuffers_) {
+        for(auto framebuffer : objs.framebuffers) {
             vkDestroyFramebuffer(device_, framebuffer, nullptr);
         }
-        vkDestroyPipeline(device_, graphics_pipeline_, nullptr);
-        vkDestroyPipelineLayout(device_, pipeline_layout_, nullptr);
-        vkDestroyRenderPass(device_, render_pass_, nullptr);
-        for (auto view : swap_chain_image_views_) {
+        for(auto view : objs.image_views) {
             vkDestroyImageView(device_, view, nullptr);
         }
-        vkDestroySwapchainKHR(device_, swap_chain_, nullptr);
+        if(headless()) {
+            vk_util::destroy_images(allocator_, objs.images, objs.offscreen_memories);
+        } else {
+            vkDestroySwapchainKHR(device_, objs.swap_chain, nullptr);
+        }
+        objs = {};
+    }
 
+    void destroy_pipelines_() {
+        for(std::size_t i = 0; i < graphics_pipelines_.size(); ++i) {
+            vkDestroyPipeline(device_, graphics_pipelines_[i], nullptr);
+            vkDestroyPipelineLayout(device_, pipeline_layouts_[i], nullptr);
+        }
+        pipeline_layouts_.clear();
+        graphics_pipelines_.clear();
+        vkDestroyRenderPass(device_, render_pass_, nullptr);
+    }
+
+    // The device must be idle.
+    void release_all_retired_() {
+        for(auto& retired : retired_) {
+            destroy_images_(retired.images);
+        }
+        retired_.clear();
     }
 
 
@@ -138,23 +239,18 @@ private:
     VkSurfaceKHR       surface_;
     QueueFamilyIndices qf_indices_;
     VkDevice           device_;
+    MemoryAllocator&   allocator_;
+    VkPipelineCache    pipeline_cache_; // Used for all pipeline creations
 
-    // Swap chain managed objects
-    VkSwapchainKHR     swap_chain_;
-    std::vector< VkImage > swap_chain_images_;
-    VkFormat           swap_chain_image_format_;
-    VkExtent2D         swap_chain_extent_;
-
-    std::vector< VkImageView > swap_chain_image_views_;
+    // Objects of the current images
+    ImageObjects       images_;
+    // Objects of replaced images, oldest first
+    std::deque< RetiredImageObjects > retired_;
 
+    // Kept across recreations with the same format
     VkRenderPass       render_pass_;
-    VkPipelineLayout   pipeline_layout_;
-    VkPipeline         graphics_pipeline_;
-
-    std::vector< VkFramebuffer > framebuffers_;
-
-    std::vector< VkCommandPool > command_pools_;
-    std::vector< VkCommandBuffer > command_buffers_;
+    std::vector< VkPipelineLayout > pipeline_layouts_;
+    std::vector< VkPipeline >       graphics_pipelines_;
 };
 
 } // namespace vk_util
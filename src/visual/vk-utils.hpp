@@ -3,17 +3,24 @@
 
 #include <algorithm> // clamp
 #include <array>
+#include <cstddef> // offsetof
 #include <cstdint>
+#include <cstring> // memcmp, memcpy
+#include <functional>
 #include <limits>
 #include <optional>
 #include <set>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <tuple>
 #include <vector>
 
+#include <glm/vec2.hpp>
+
 #include "visual-common.hpp"
 #include "visual/shaders/shaders.hpp"
+#include "visual/vk-memory-allocator.hpp"
 
 // This file provides helper functions for generating vk instances and related
 // configurations.
@@ -29,7 +36,10 @@ inline const std::vector< const char* > device_extensions = {
 // VkInstance creation
 //-----------------------------------------------------------------------------
 // The instance should be properly destroyed after use.
-inline auto create_instance() {
+//
+// A headless instance does not enable the window system extensions, so it
+// can be created on machines without a display.
+inline auto create_instance(bool headless = false) {
     VkInstance instance;
 
     // App info
@@ -47,9 +57,11 @@ inline auto create_instance() {
     ci.pApplicationInfo = &app_info;
 
     std::uint32_t glfwExtensionCount = 0;
-    const char** glfwExtensions;
+    const char** glfwExtensions = nullptr;
 
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    if(!headless) {
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    }
 
     ci.enabledExtensionCount = glfwExtensionCount;
     ci.ppEnabledExtensionNames = glfwExtensions;
@@ -95,6 +107,8 @@ struct QueueFamilyIndices {
             && transfer_family.has_value();
     }
 };
+// Without a surface (VK_NULL_HANDLE), nothing is presented, and the present
+// family is the graphics family.
 inline auto find_queue_families(
     VkPhysicalDevice phys_dev,
     VkSurfaceKHR     surface
@@ -108,13 +122,15 @@ inline auto find_queue_families(
     vkGetPhysicalDeviceQueueFamilyProperties(phys_dev, &qf_count, qf.data());
 
     for(int i = 0; i < qf.size(); ++i) {
-        if(qf[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        // Compute work, such as particle simulation, is recorded together
+        // with the graphics work of a frame.
+        if((qf[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) && (qf[i].queueFlags & VK_QUEUE_COMPUTE_BIT)) {
             indices.graphics_family = i;
         }
         if(qf[i].queueFlags & VK_QUEUE_TRANSFER_BIT) {
             indices.transfer_family = i;
         }
-        {
+        if(surface != VK_NULL_HANDLE) {
             VkBool32 present_support = false;
             vkGetPhysicalDeviceSurfaceSupportKHR(phys_dev, i, surface, &present_support);
             if(present_support) {
@@ -123,9 +139,23 @@ inline auto find_queue_families(
         }
     }
 
+    if(surface == VK_NULL_HANDLE) {
+        indices.present_family = indices.graphics_family;
+    }
+
     return indices;
 }
 
+// The distinct queue families of buffers written on the transfer queue and
+// read on the graphics queue.
+inline auto transfer_graphics_families(const QueueFamilyIndices& indices) {
+    std::set< std::uint32_t > unique_set {
+        indices.graphics_family.value(),
+        indices.transfer_family.value()
+    };
+    return std::vector< std::uint32_t >(unique_set.begin(), unique_set.end());
+}
+
 // Swap chain support
 //-----------------------------------------------------------------------------
 struct SwapChainSupportDetails {
@@ -197,7 +227,9 @@ inline auto create_swap_chain(
     VkSurfaceKHR     surface,
     VkDevice         dev,
     std::uint32_t    width,
-    std::uint32_t    height
+    std::uint32_t    height,
+    // The swap chain being replaced, which is retired but not destroyed
+    VkSwapchainKHR   old_swap_chain = VK_NULL_HANDLE
 ) {
     VkSwapchainKHR sc;
     std::vector< VkImage > sc_images;
@@ -248,7 +280,7 @@ inline auto create_swap_chain(
     ci.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     ci.presentMode = pm;
     ci.clipped = VK_TRUE;
-    ci.oldSwapchain = VK_NULL_HANDLE;
+    ci.oldSwapchain = old_swap_chain;
 
     // Create the swap chain
     if(vkCreateSwapchainKHR(dev, &ci, nullptr, &sc) != VK_SUCCESS) {
@@ -305,13 +337,23 @@ inline auto create_image_views(
 
 // Physical devices
 //-----------------------------------------------------------------------------
-inline auto check_physical_device_extension_support(VkPhysicalDevice phys_dev) {
+// Device extensions needed with or without a surface (VK_NULL_HANDLE).
+inline const std::vector< const char* >& required_device_extensions(VkSurfaceKHR surface) {
+    static const std::vector< const char* > headless_extensions;
+    return surface == VK_NULL_HANDLE ? headless_extensions : device_extensions;
+}
+
+inline auto check_physical_device_extension_support(
+    VkPhysicalDevice phys_dev,
+    VkSurfaceKHR     surface
+) {
     std::uint32_t ext_count;
     vkEnumerateDeviceExtensionProperties(phys_dev, nullptr, &ext_count, nullptr);
     std::vector< VkExtensionProperties > available_exts(ext_count);
     vkEnumerateDeviceExtensionProperties(phys_dev, nullptr, &ext_count, available_exts.data());
 
-    std::set< std::string > unsupported_exts(device_extensions.begin(), device_extensions.end());
+    const auto& exts = required_device_extensions(surface);
+    std::set< std::string > unsupported_exts(exts.begin(), exts.end());
     for(const auto& ext : available_exts) {
         unsupported_exts.erase(ext.extensionName);
     }
@@ -325,10 +367,11 @@ inline bool is_physical_device_suitable(
 ) {
     const auto indices = find_queue_families(phys_dev, surface);
 
-    const bool extensions_supported = check_physical_device_extension_support(phys_dev);
+    const bool extensions_supported = check_physical_device_extension_support(phys_dev, surface);
 
-    bool swap_chain_adequate = false;
-    if(extensions_supported) {
+    // Without a surface, there is no swap chain to support
+    bool swap_chain_adequate = surface == VK_NULL_HANDLE;
+    if(extensions_supported && !swap_chain_adequate) {
         const auto sc = query_swap_chain_support(phys_dev, surface);
         swap_chain_adequate = !sc.formats.empty() && !sc.present_modes.empty();
     }
@@ -410,8 +453,9 @@ inline auto create_logical_device(
     ci.queueCreateInfoCount = queue_cis.size();
     ci.pEnabledFeatures = &device_features;
 
-    ci.enabledExtensionCount = device_extensions.size();
-    ci.ppEnabledExtensionNames = device_extensions.data();
+    const auto& exts = required_device_extensions(surface);
+    ci.enabledExtensionCount = exts.size();
+    ci.ppEnabledExtensionNames = exts.data();
 
     if(enable_validation_layer) {
         ci.enabledLayerCount = static_cast<std::uint32_t>(default_validation_layers.size());
@@ -436,9 +480,13 @@ inline auto create_logical_device(
 
 // Render passes
 //-----------------------------------------------------------------------------
+// The final layout of the color attachment is for presentation by default.
+// Offscreen targets use another layout, which keeps the render pass
+// compatible with the same pipelines.
 inline auto create_render_pass(
-    VkDevice dev,
-    VkFormat swap_chain_image_format
+    VkDevice      dev,
+    VkFormat      swap_chain_image_format,
+    VkImageLayout final_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
 ) {
     VkRenderPass render_pass;
 
@@ -450,7 +498,7 @@ inline auto create_render_pass(
     color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    color_attachment.finalLayout = final_layout;
 
     VkAttachmentReference color_attachment_ref {};
     color_attachment_ref.attachment = 0;
@@ -486,6 +534,74 @@ inline auto create_render_pass(
 }
 
 
+// Pipeline caches
+//-----------------------------------------------------------------------------
+// Checks whether cache data was created by the same driver and device, using
+// the header defined by VK_PIPELINE_CACHE_HEADER_VERSION_ONE. Data from
+// other devices or driver versions can be rejected or misused by drivers, so
+// it should be discarded.
+inline bool is_pipeline_cache_data_compatible(
+    VkPhysicalDevice                   phys_dev,
+    const std::vector< unsigned char >& data
+) {
+    // Header: size, version, vendor ID and device ID, then the UUID
+    constexpr std::size_t header_size = 4 * sizeof(std::uint32_t) + VK_UUID_SIZE;
+    if(data.size() < header_size) return false;
+
+    std::uint32_t fields[4];
+    std::memcpy(fields, data.data(), sizeof(fields));
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(phys_dev, &props);
+
+    return fields[0] >= header_size
+        && fields[0] <= data.size()
+        && fields[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        && fields[2] == props.vendorID
+        && fields[3] == props.deviceID
+        && std::memcmp(data.data() + sizeof(fields), props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+// Creates a pipeline cache with the initial data, which must be compatible
+// (or empty). The cache should be properly destroyed after use.
+inline auto create_pipeline_cache(
+    VkDevice                            dev,
+    const std::vector< unsigned char >& initial_data
+) {
+    VkPipelineCache pipeline_cache;
+
+    VkPipelineCacheCreateInfo ci {};
+    ci.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    ci.initialDataSize = initial_data.size();
+    ci.pInitialData = initial_data.data();
+
+    if(vkCreatePipelineCache(dev, &ci, nullptr, &pipeline_cache) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create pipeline cache.");
+    }
+
+    return pipeline_cache;
+}
+
+inline auto get_pipeline_cache_data(
+    VkDevice        dev,
+    VkPipelineCache pipeline_cache
+) {
+    std::vector< unsigned char > data;
+
+    std::size_t size = 0;
+    if(vkGetPipelineCacheData(dev, pipeline_cache, &size, nullptr) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to get pipeline cache data.");
+    }
+    data.resize(size);
+    if(vkGetPipelineCacheData(dev, pipeline_cache, &size, data.data()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to get pipeline cache data.");
+    }
+    data.resize(size);
+
+    return data;
+}
+
+
 // Graphics pipelines
 //-----------------------------------------------------------------------------
 inline auto create_shader_module(
@@ -505,20 +621,42 @@ inline auto create_shader_module(
 
     return res;
 }
+// The camera block of the vertex shaders, a uniform buffer at binding 0 of
+// set 0. World positions p are placed in clip space as
+//   zoom * (view * p).xy + shake
+// Pipelines using it must have the same set layout, so that the set stays
+// bound across them.
+struct CameraUniforms {
+    glm::mat4 view { 1.0f };
+    glm::vec2 shake { 0.0f, 0.0f }; // In clip space
+    float     zoom = 1.0f;
+
+    bool operator==(const CameraUniforms&) const = default;
+};
+// Same offsets as the block in the shaders (std140 layout)
+static_assert(offsetof(CameraUniforms, shake) == 64);
+static_assert(offsetof(CameraUniforms, zoom) == 72);
+
+// The swap chain independent part of a graphics pipeline: the shaders and the
+// vertex input layout.
+struct GraphicsPipelineDesc {
+    const std::vector< unsigned char >* p_vertex_shader;
+    const std::vector< unsigned char >* p_fragment_shader;
+    std::vector< VkVertexInputBindingDescription >   binding_desc;
+    std::vector< VkVertexInputAttributeDescription > attr_desc;
+    std::vector< VkDescriptorSetLayout >             set_layouts;
+};
 inline auto create_graphics_pipeline(
     VkDevice     dev,
-    VkExtent2D   swap_chain_extent,
     VkRenderPass render_pass,
-    VkVertexInputBindingDescription
-                 vi_binding_desc,
-    const std::vector< VkVertexInputAttributeDescription >&
-                 vi_attr_desc
+    const GraphicsPipelineDesc& desc,
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE
 ) {
     VkPipelineLayout pipeline_layout;
     VkPipeline       graphics_pipeline;
 
-    const auto vert_sm = create_shader_module(dev, vertex_shader::shader);
-    const auto frag_sm = create_shader_module(dev, fragment_shader::shader);
+    const auto vert_sm = create_shader_module(dev, *desc.p_vertex_shader);
+    const auto frag_sm = create_shader_module(dev, *desc.p_fragment_shader);
 
     VkPipelineShaderStageCreateInfo vert_ci {};
     vert_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -539,34 +677,23 @@ inline auto create_graphics_pipeline(
 
     VkPipelineVertexInputStateCreateInfo vertex_input_ci {};
     vertex_input_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertex_input_ci.vertexBindingDescriptionCount = 1;
-    vertex_input_ci.pVertexBindingDescriptions = &vi_binding_desc;
-    vertex_input_ci.vertexAttributeDescriptionCount = std::size(vi_attr_desc);
-    vertex_input_ci.pVertexAttributeDescriptions = vi_attr_desc.data();
+    vertex_input_ci.vertexBindingDescriptionCount = std::size(desc.binding_desc);
+    vertex_input_ci.pVertexBindingDescriptions = desc.binding_desc.data();
+    vertex_input_ci.vertexAttributeDescriptionCount = std::size(desc.attr_desc);
+    vertex_input_ci.pVertexAttributeDescriptions = desc.attr_desc.data();
 
     VkPipelineInputAssemblyStateCreateInfo input_asm_ci {};
     input_asm_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
     input_asm_ci.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
     input_asm_ci.primitiveRestartEnable = VK_FALSE;
 
-    VkViewport viewport {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = swap_chain_extent.width;
-    viewport.height = swap_chain_extent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-
-    VkRect2D scissor {};
-    scissor.offset = {0, 0};
-    scissor.extent = swap_chain_extent;
-
+    // Viewport and scissor are dynamic, so that the pipeline outlives resizes
     VkPipelineViewportStateCreateInfo vp_ci {};
     vp_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     vp_ci.viewportCount = 1;
-    vp_ci.pViewports = &viewport;
+    vp_ci.pViewports = nullptr;
     vp_ci.scissorCount = 1;
-    vp_ci.pScissors = &scissor;
+    vp_ci.pScissors = nullptr;
 
     VkPipelineRasterizationStateCreateInfo rasterizer_ci {};
     rasterizer_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -574,7 +701,8 @@ inline auto create_graphics_pipeline(
     rasterizer_ci.rasterizerDiscardEnable = VK_FALSE;
     rasterizer_ci.polygonMode = VK_POLYGON_MODE_FILL;
     rasterizer_ci.lineWidth = 1.0f;
-    rasterizer_ci.cullMode = VK_CULL_MODE_BACK_BIT;
+    // Winding may be flipped by instance transforms, and 2D shapes have no back
+    rasterizer_ci.cullMode = VK_CULL_MODE_NONE;
     rasterizer_ci.frontFace = VK_FRONT_FACE_CLOCKWISE;
     rasterizer_ci.depthBiasEnable = VK_FALSE;
     rasterizer_ci.depthBiasConstantFactor = 0.0f;
@@ -613,17 +741,17 @@ inline auto create_graphics_pipeline(
 
     VkDynamicState dynamic_states[] {
         VK_DYNAMIC_STATE_VIEWPORT,
-        VK_DYNAMIC_STATE_LINE_WIDTH
+        VK_DYNAMIC_STATE_SCISSOR
     };
     VkPipelineDynamicStateCreateInfo ds_ci {};
     ds_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    ds_ci.dynamicStateCount = 2;
+    ds_ci.dynamicStateCount = std::size(dynamic_states);
     ds_ci.pDynamicStates = dynamic_states;
 
     VkPipelineLayoutCreateInfo pl_ci {};
     pl_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pl_ci.setLayoutCount = 0;
-    pl_ci.pSetLayouts = nullptr;
+    pl_ci.setLayoutCount = std::size(desc.set_layouts);
+    pl_ci.pSetLayouts = desc.set_layouts.data();
     pl_ci.pushConstantRangeCount = 0;
     pl_ci.pPushConstantRanges = nullptr;
 
@@ -642,14 +770,14 @@ inline auto create_graphics_pipeline(
     pipeline_ci.pMultisampleState = &multisample_ci;
     pipeline_ci.pDepthStencilState = nullptr;
     pipeline_ci.pColorBlendState = &cb_ci;
-    pipeline_ci.pDynamicState = nullptr; // &ds_ci;
+    pipeline_ci.pDynamicState = &ds_ci;
     pipeline_ci.layout = pipeline_layout;
     pipeline_ci.renderPass = render_pass;
     pipeline_ci.subpass = 0;
     pipeline_ci.basePipelineHandle = VK_NULL_HANDLE;
     pipeline_ci.basePipelineIndex = -1;
 
-    if(vkCreateGraphicsPipelines(dev, VK_NULL_HANDLE, 1, &pipeline_ci, nullptr, &graphics_pipeline) != VK_SUCCESS) {
+    if(vkCreateGraphicsPipelines(dev, pipeline_cache, 1, &pipeline_ci, nullptr, &graphics_pipeline) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create graphics pipeline.");
     }
 
@@ -660,6 +788,247 @@ inline auto create_graphics_pipeline(
 }
 
 
+// Compute pipelines
+//-----------------------------------------------------------------------------
+inline auto create_compute_pipeline(
+    VkDevice                          dev,
+    const std::vector<unsigned char>& shader,
+    VkDescriptorSetLayout             set_layout,
+    std::uint32_t                     push_constant_size,
+    VkPipelineCache                   pipeline_cache = VK_NULL_HANDLE
+) {
+    VkPipelineLayout pipeline_layout;
+    VkPipeline       compute_pipeline;
+
+    const auto comp_sm = create_shader_module(dev, shader);
+
+    VkPushConstantRange pc_range {};
+    pc_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pc_range.offset = 0;
+    pc_range.size = push_constant_size;
+
+    VkPipelineLayoutCreateInfo pl_ci {};
+    pl_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pl_ci.setLayoutCount = 1;
+    pl_ci.pSetLayouts = &set_layout;
+    pl_ci.pushConstantRangeCount = push_constant_size ? 1 : 0;
+    pl_ci.pPushConstantRanges = push_constant_size ? &pc_range : nullptr;
+
+    if(vkCreatePipelineLayout(dev, &pl_ci, nullptr, &pipeline_layout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create pipeline layout.");
+    }
+
+    VkComputePipelineCreateInfo pipeline_ci {};
+    pipeline_ci.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_ci.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipeline_ci.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipeline_ci.stage.module = comp_sm;
+    pipeline_ci.stage.pName = "main";
+    pipeline_ci.layout = pipeline_layout;
+    pipeline_ci.basePipelineHandle = VK_NULL_HANDLE;
+    pipeline_ci.basePipelineIndex = -1;
+
+    if(vkCreateComputePipelines(dev, pipeline_cache, 1, &pipeline_ci, nullptr, &compute_pipeline) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create compute pipeline.");
+    }
+
+    vkDestroyShaderModule(dev, comp_sm, nullptr);
+
+    return std::tuple(pipeline_layout, compute_pipeline);
+}
+
+
+// Descriptor sets
+//-----------------------------------------------------------------------------
+// A layout of storage buffers at bindings 0, 1, ..., num_buffers - 1.
+inline auto create_storage_buffer_set_layout(
+    VkDevice           dev,
+    std::uint32_t      num_buffers,
+    VkShaderStageFlags stage_f
+) {
+    VkDescriptorSetLayout set_layout;
+
+    std::vector< VkDescriptorSetLayoutBinding > bindings(num_buffers);
+    for(std::uint32_t i = 0; i < num_buffers; ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = stage_f;
+    }
+
+    VkDescriptorSetLayoutCreateInfo ci {};
+    ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    ci.bindingCount = num_buffers;
+    ci.pBindings = bindings.data();
+
+    if(vkCreateDescriptorSetLayout(dev, &ci, nullptr, &set_layout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create descriptor set layout.");
+    }
+
+    return set_layout;
+}
+
+// Creates a pool with one set of the layout, and writes the storage buffers
+// into the set. The set is freed with the pool.
+inline auto create_storage_buffer_set(
+    VkDevice                      dev,
+    VkDescriptorSetLayout         set_layout,
+    const std::vector< VkBuffer >& buffers
+) {
+    VkDescriptorPool pool;
+    VkDescriptorSet  set;
+
+    VkDescriptorPoolSize pool_size {};
+    pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    pool_size.descriptorCount = buffers.size();
+
+    VkDescriptorPoolCreateInfo pool_ci {};
+    pool_ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_ci.maxSets = 1;
+    pool_ci.poolSizeCount = 1;
+    pool_ci.pPoolSizes = &pool_size;
+
+    if(vkCreateDescriptorPool(dev, &pool_ci, nullptr, &pool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create descriptor pool.");
+    }
+
+    VkDescriptorSetAllocateInfo ai {};
+    ai.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    ai.descriptorPool = pool;
+    ai.descriptorSetCount = 1;
+    ai.pSetLayouts = &set_layout;
+
+    if(vkAllocateDescriptorSets(dev, &ai, &set) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate descriptor set.");
+    }
+
+    std::vector< VkDescriptorBufferInfo > buffer_infos(buffers.size());
+    std::vector< VkWriteDescriptorSet >   writes(buffers.size());
+    for(std::size_t i = 0; i < buffers.size(); ++i) {
+        buffer_infos[i].buffer = buffers[i];
+        buffer_infos[i].offset = 0;
+        buffer_infos[i].range = VK_WHOLE_SIZE;
+
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = set;
+        writes[i].dstBinding = i;
+        writes[i].dstArrayElement = 0;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].descriptorCount = 1;
+        writes[i].pBufferInfo = &buffer_infos[i];
+    }
+    vkUpdateDescriptorSets(dev, writes.size(), writes.data(), 0, nullptr);
+
+    return std::tuple(pool, set);
+}
+
+// A layout of one uniform buffer at binding 0.
+inline auto create_uniform_buffer_set_layout(
+    VkDevice           dev,
+    VkShaderStageFlags stage_f
+) {
+    VkDescriptorSetLayout set_layout;
+
+    VkDescriptorSetLayoutBinding binding {};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    binding.descriptorCount = 1;
+    binding.stageFlags = stage_f;
+
+    VkDescriptorSetLayoutCreateInfo ci {};
+    ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    ci.bindingCount = 1;
+    ci.pBindings = &binding;
+
+    if(vkCreateDescriptorSetLayout(dev, &ci, nullptr, &set_layout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create descriptor set layout.");
+    }
+
+    return set_layout;
+}
+
+// Creates a pool with one set of the layout for each uniform buffer, and
+// writes each buffer into its set. The sets are freed with the pool.
+inline auto create_uniform_buffer_sets(
+    VkDevice                       dev,
+    VkDescriptorSetLayout          set_layout,
+    const std::vector< VkBuffer >& buffers
+) {
+    VkDescriptorPool pool;
+    std::vector< VkDescriptorSet > sets(buffers.size());
+
+    VkDescriptorPoolSize pool_size {};
+    pool_size.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    pool_size.descriptorCount = buffers.size();
+
+    VkDescriptorPoolCreateInfo pool_ci {};
+    pool_ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_ci.maxSets = buffers.size();
+    pool_ci.poolSizeCount = 1;
+    pool_ci.pPoolSizes = &pool_size;
+
+    if(vkCreateDescriptorPool(dev, &pool_ci, nullptr, &pool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create descriptor pool.");
+    }
+
+    const std::vector< VkDescriptorSetLayout > set_layouts(buffers.size(), set_layout);
+    VkDescriptorSetAllocateInfo ai {};
+    ai.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    ai.descriptorPool = pool;
+    ai.descriptorSetCount = set_layouts.size();
+    ai.pSetLayouts = set_layouts.data();
+
+    if(vkAllocateDescriptorSets(dev, &ai, sets.data()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate descriptor set.");
+    }
+
+    std::vector< VkDescriptorBufferInfo > buffer_infos(buffers.size());
+    std::vector< VkWriteDescriptorSet >   writes(buffers.size());
+    for(std::size_t i = 0; i < buffers.size(); ++i) {
+        buffer_infos[i].buffer = buffers[i];
+        buffer_infos[i].offset = 0;
+        buffer_infos[i].range = VK_WHOLE_SIZE;
+
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = sets[i];
+        writes[i].dstBinding = 0;
+        writes[i].dstArrayElement = 0;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        writes[i].descriptorCount = 1;
+        writes[i].pBufferInfo = &buffer_infos[i];
+    }
+    vkUpdateDescriptorSets(dev, writes.size(), writes.data(), 0, nullptr);
+
+    return std::tuple(pool, sets);
+}
+
+
+// Timestamp queries
+//-----------------------------------------------------------------------------
+// Consecutive timestamp queries in a pool, written by a recording function.
+// Each recording function documents how many queries it writes from
+// first_query.
+struct TimestampQueries {
+    VkQueryPool   query_pool = VK_NULL_HANDLE;
+    std::uint32_t first_query = 0;
+};
+
+inline auto create_timestamp_query_pool(VkDevice dev, std::uint32_t num_queries) {
+    VkQueryPool query_pool;
+
+    VkQueryPoolCreateInfo ci {};
+    ci.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    ci.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    ci.queryCount = num_queries;
+
+    if(vkCreateQueryPool(dev, &ci, nullptr, &query_pool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create query pool.");
+    }
+
+    return query_pool;
+}
+
+
 // Framebuffers
 //-----------------------------------------------------------------------------
 inline auto create_framebuffers(
@@ -696,76 +1065,104 @@ inline auto create_framebuffers(
 // Vertex buffer
 //-----------------------------------------------------------------------------
 
-inline std::uint32_t find_memory_type(
-    VkPhysicalDevice      phys_dev,
-    std::uint32_t         type_filter,
-    VkMemoryPropertyFlags prop_f
-) {
-    VkPhysicalDeviceMemoryProperties mem_prop;
-    vkGetPhysicalDeviceMemoryProperties(phys_dev, &mem_prop);
-
-    for(std::uint32_t i = 0; i < mem_prop.memoryTypeCount; ++i) {
-        if(type_filter & (1 << i) && (mem_prop.memoryTypes[i].propertyFlags & prop_f) == prop_f) {
-            return i;
-        }
-    }
-
-    throw std::runtime_error("Failed to find a suitable memory type.");
-}
-
+// Creates a buffer in memory from the allocator. The buffer should be
+// destroyed with destroy_buffer.
+//
+// A buffer used by several queue families is shared concurrently, so that
+// its contents stay defined without ownership transfers.
 inline auto create_buffer(
-    VkPhysicalDevice      phys_dev,
-    VkDevice              device,
+    MemoryAllocator&      allocator,
     VkDeviceSize          size,
     VkBufferUsageFlags    usage_f,
-    VkMemoryPropertyFlags mem_prop_f
+    VkMemoryPropertyFlags mem_prop_f,
+    const std::vector< std::uint32_t >& queue_families = {}
 ) {
-    VkBuffer       buffer;
-    VkDeviceMemory buffer_memory;
+    const auto device = allocator.device();
+    VkBuffer buffer;
 
     // Create buffer
     VkBufferCreateInfo buf_ci {};
     buf_ci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     buf_ci.size = size;
     buf_ci.usage = usage_f;
-    buf_ci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if(queue_families.size() > 1) {
+        buf_ci.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        buf_ci.queueFamilyIndexCount = queue_families.size();
+        buf_ci.pQueueFamilyIndices = queue_families.data();
+    } else {
+        buf_ci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
 
     if(vkCreateBuffer(device, &buf_ci, nullptr, &buffer) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create buffer.");
     }
 
-    // Create buffer memory
+    // Sub-allocate buffer memory
     VkMemoryRequirements mem_req;
     vkGetBufferMemoryRequirements(device, buffer, &mem_req);
 
-    VkMemoryAllocateInfo alloc_info {};
-    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    alloc_info.allocationSize = mem_req.size;
-    alloc_info.memoryTypeIndex = find_memory_type(
-        phys_dev,
-        mem_req.memoryTypeBits,
-        mem_prop_f
-    );
-
-    if(vkAllocateMemory(device, &alloc_info, nullptr, &buffer_memory) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to allocate buffer memory.");
+    MemoryAllocation allocation;
+    try {
+        allocation = allocator.allocate(mem_req, mem_prop_f);
+    } catch(...) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        throw;
     }
 
     // Bind buffer memory
-    vkBindBufferMemory(device, buffer, buffer_memory, 0);
+    vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
 
     return std::tuple(
         buffer,
-        buffer_memory
+        allocation
     );
 }
 
+// Whether buffers with the usage can be placed in memory with all the
+// properties. The memory types allowed for a buffer do not depend on its
+// size, so a small buffer is created to find them.
+inline bool buffer_memory_supported(
+    const MemoryAllocator& allocator,
+    VkBufferUsageFlags     usage_f,
+    VkMemoryPropertyFlags  mem_prop_f
+) {
+    const auto device = allocator.device();
+    VkBuffer buffer;
+
+    VkBufferCreateInfo buf_ci {};
+    buf_ci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buf_ci.size = 1;
+    buf_ci.usage = usage_f;
+    buf_ci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if(vkCreateBuffer(device, &buf_ci, nullptr, &buffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create buffer.");
+    }
+
+    VkMemoryRequirements mem_req;
+    vkGetBufferMemoryRequirements(device, buffer, &mem_req);
+    vkDestroyBuffer(device, buffer, nullptr);
+
+    return allocator.has_memory_type(mem_req.memoryTypeBits, mem_prop_f);
+}
+
+inline void destroy_buffer(
+    MemoryAllocator&        allocator,
+    VkBuffer                buffer,
+    const MemoryAllocation& allocation
+) {
+    vkDestroyBuffer(allocator.device(), buffer, nullptr);
+    allocator.free(allocation);
+}
+
 inline void copy_buffer(
     VkDevice      device,
     VkCommandPool command_pool,
     VkQueue       transfer_queue,
     VkBuffer      src_buffer,
     VkBuffer      dst_buffer,
+    VkDeviceSize  src_offset,
+    VkDeviceSize  dst_offset,
     VkDeviceSize  size
 ) {
     VkCommandBufferAllocateInfo ai {};
@@ -785,8 +1182,8 @@ inline void copy_buffer(
     vkBeginCommandBuffer(command_buffer, &bi);
 
     VkBufferCopy copy_region {};
-    copy_region.srcOffset = 0;
-    copy_region.dstOffset = 0;
+    copy_region.srcOffset = src_offset;
+    copy_region.dstOffset = dst_offset;
     copy_region.size = size;
     vkCmdCopyBuffer(command_buffer, src_buffer, dst_buffer, 1, &copy_region);
 
@@ -805,12 +1202,134 @@ inline void copy_buffer(
     vkFreeCommandBuffers(device, command_pool, 1, &command_buffer);
 }
 
+// Records copies of buffer regions into a reusable command buffer and submits
+// them without waiting on the host.
+//
+// If timestamps are given, two queries, which must have been reset, are
+// written before and after the copies.
+//
+// The command buffer must come from a pool created with
+// VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, and must not be pending
+// execution. The signal semaphore is signaled when the copy is complete, and
+// should be waited for by the commands reading the destination buffer. The
+// wait semaphore and the fence are optional (VK_NULL_HANDLE).
+inline void submit_copy_buffer(
+    VkCommandBuffer command_buffer,
+    VkQueue         transfer_queue,
+    VkBuffer        src_buffer,
+    VkBuffer        dst_buffer,
+    std::span< const VkBufferCopy > regions,
+    VkSemaphore     wait_semaphore,
+    VkSemaphore     signal_semaphore,
+    VkFence         fence,
+    const std::optional< TimestampQueries >& timestamps = std::nullopt
+) {
+    // Recording
+    VkCommandBufferBeginInfo bi {};
+    bi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    bi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    if(vkBeginCommandBuffer(command_buffer, &bi) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin recording transfer command buffer.");
+    }
+
+    if(timestamps) {
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamps->query_pool, timestamps->first_query);
+    }
+
+    vkCmdCopyBuffer(command_buffer, src_buffer, dst_buffer, regions.size(), regions.data());
+
+    if(timestamps) {
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamps->query_pool, timestamps->first_query + 1);
+    }
+
+    if(vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to record transfer command buffer.");
+    }
+
+    // Submit
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+    VkSubmitInfo si {};
+    si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    if(wait_semaphore != VK_NULL_HANDLE) {
+        si.waitSemaphoreCount = 1;
+        si.pWaitSemaphores = &wait_semaphore;
+        si.pWaitDstStageMask = &wait_stage;
+    }
+    si.commandBufferCount = 1;
+    si.pCommandBuffers = &command_buffer;
+    si.signalSemaphoreCount = 1;
+    si.pSignalSemaphores = &signal_semaphore;
+
+    if(vkQueueSubmit(transfer_queue, 1, &si, fence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit transfer command buffer.");
+    }
+}
+
+
+// Offscreen images
+//-----------------------------------------------------------------------------
+// Creates device local color images to render into without a swap chain,
+// in memory from the allocator. The images should be destroyed with
+// destroy_images.
+inline auto create_offscreen_images(
+    MemoryAllocator& allocator,
+    std::size_t      num_images,
+    VkFormat         format,
+    VkExtent2D       extent
+) {
+    const auto dev = allocator.device();
+    std::vector< VkImage >          images(num_images);
+    std::vector< MemoryAllocation > allocations(num_images);
+
+    for(std::size_t i = 0; i < num_images; ++i) {
+        VkImageCreateInfo ci {};
+        ci.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        ci.imageType = VK_IMAGE_TYPE_2D;
+        ci.format = format;
+        ci.extent = { extent.width, extent.height, 1 };
+        ci.mipLevels = 1;
+        ci.arrayLayers = 1;
+        ci.samples = VK_SAMPLE_COUNT_1_BIT;
+        ci.tiling = VK_IMAGE_TILING_OPTIMAL;
+        // Transfer source allows the frames to be read back
+        ci.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        ci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        ci.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        if(vkCreateImage(dev, &ci, nullptr, &images[i]) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create offscreen image.");
+        }
+
+        VkMemoryRequirements mem_req;
+        vkGetImageMemoryRequirements(dev, images[i], &mem_req);
+
+        allocations[i] = allocator.allocate(mem_req, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+        vkBindImageMemory(dev, images[i], allocations[i].memory, allocations[i].offset);
+    }
+
+    return std::tuple(images, allocations);
+}
+
+inline void destroy_images(
+    MemoryAllocator&                       allocator,
+    const std::vector< VkImage >&          images,
+    const std::vector< MemoryAllocation >& allocations
+) {
+    for(std::size_t i = 0; i < images.size(); ++i) {
+        vkDestroyImage(allocator.device(), images[i], nullptr);
+        allocator.free(allocations[i]);
+    }
+}
+
 
 // Command pool and buffers
 //-----------------------------------------------------------------------------
 inline auto create_graphics_command_pool(
     VkDevice                  dev,
-    const QueueFamilyIndices& qf_indices
+    const QueueFamilyIndices& qf_indices,
+    VkCommandPoolCreateFlags  flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT
 ) {
     VkCommandPool graphics_command_pool;
 
@@ -818,7 +1337,7 @@ inline auto create_graphics_command_pool(
         VkCommandPoolCreateInfo ci {};
         ci.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
         ci.queueFamilyIndex = qf_indices.graphics_family.value();
-        ci.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        ci.flags = flags;
 
         if(vkCreateCommandPool(dev, &ci, nullptr, &graphics_command_pool) != VK_SUCCESS) {
             throw std::runtime_error("Failed to create graphics command pool.");
@@ -837,7 +1356,8 @@ inline auto create_transfer_command_pool(
         VkCommandPoolCreateInfo ci {};
         ci.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
         ci.queueFamilyIndex = qf_indices.transfer_family.value();
-        ci.flags = 0;
+        // Allows command buffers to be reused for streaming transfers
+        ci.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
         if(vkCreateCommandPool(dev, &ci, nullptr, &transfer_command_pool) != VK_SUCCESS) {
             throw std::runtime_error("Failed to create transfer command pool.");
@@ -847,6 +1367,27 @@ inline auto create_transfer_command_pool(
     return transfer_command_pool;
 }
 
+inline auto allocate_command_buffers(
+    VkDevice             dev,
+    VkCommandPool        command_pool,
+    std::size_t          num_buffers,
+    VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY
+) {
+    std::vector< VkCommandBuffer > command_buffers(num_buffers);
+
+    VkCommandBufferAllocateInfo ai {};
+    ai.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    ai.commandPool = command_pool;
+    ai.level = level;
+    ai.commandBufferCount = num_buffers;
+
+    if(vkAllocateCommandBuffers(dev, &ai, command_buffers.data()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate command buffers.");
+    }
+
+    return command_buffers;
+}
+
 inline auto create_graphics_command_pools_and_buffers(
     VkDevice                  dev,
     const QueueFamilyIndices& qf_indices,
@@ -873,14 +1414,45 @@ inline auto create_graphics_command_pools_and_buffers(
     return std::tuple(command_pools, command_buffers);
 }
 
-inline void record_graphics_command_buffer(
-    VkExtent2D      swap_chain_extent,
-    VkRenderPass    render_pass,
-    VkPipeline      graphics_pipeline,
-    VkFramebuffer   framebuffer,
-    VkCommandBuffer command_buffer,
-    VkBuffer        vertex_buffer,
-    std::size_t     num_vertices
+// An instanced indexed draw of a mesh, with vertices and 16-bit indices in
+// the mesh buffers and per-instance data in the instance buffer.
+struct InstancedDraw {
+    std::uint32_t first_index = 0;
+    std::uint32_t num_indices = 0;
+    std::int32_t  vertex_offset = 0; // Added to the indices of the mesh
+    std::uint32_t first_instance = 0;
+    std::uint32_t num_instances = 0;
+
+    bool operator==(const InstancedDraw&) const = default;
+};
+// Instanced draws reading their instance data from the same buffer.
+//
+// If there is an indirect buffer, its first VkDrawIndexedIndirectCommand,
+// written by the device, is drawn after the draws.
+struct InstanceBufferDraws {
+    VkBuffer     instance_buffer = VK_NULL_HANDLE;
+    VkDeviceSize instance_buffer_offset = 0;
+    std::vector< InstancedDraw > draws;
+    VkBuffer     indirect_buffer = VK_NULL_HANDLE;
+
+    bool operator==(const InstanceBufferDraws&) const = default;
+};
+
+// Records the commands of a frame into a primary command buffer, around a
+// render pass whose contents are recorded by record_render_pass.
+inline void record_frame_command_buffer(
+    VkExtent2D        swap_chain_extent,
+    VkRenderPass      render_pass,
+    VkFramebuffer     framebuffer,
+    VkCommandBuffer   command_buffer,
+    VkSubpassContents render_pass_contents,
+    const std::function< void(VkCommandBuffer) >& record_render_pass,
+    // Commands outside of the render pass, such as compute dispatches
+    const std::function< void(VkCommandBuffer) >& record_before_render_pass = {},
+    const std::function< void(VkCommandBuffer) >& record_after_render_pass = {},
+    // Three queries, reset here: the start of the commands, and the start and
+    // the end of the render pass
+    const std::optional< TimestampQueries >& timestamps = std::nullopt
 ) {
     // Starting command buffer recording
     VkCommandBufferBeginInfo cb_bi {};
@@ -892,6 +1464,19 @@ inline void record_graphics_command_buffer(
         throw std::runtime_error("Failed to begin recording command buffer.");
     }
 
+    if(timestamps) {
+        vkCmdResetQueryPool(command_buffer, timestamps->query_pool, timestamps->first_query, 3);
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamps->query_pool, timestamps->first_query);
+    }
+
+    if(record_before_render_pass) {
+        record_before_render_pass(command_buffer);
+    }
+
+    if(timestamps) {
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamps->query_pool, timestamps->first_query + 1);
+    }
+
     VkRenderPassBeginInfo rp_bi {};
     rp_bi.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     rp_bi.renderPass = render_pass;
@@ -902,26 +1487,262 @@ inline void record_graphics_command_buffer(
     VkClearValue clear_color = {0.0f, 0.0f, 0.0f, 1.0f};
     rp_bi.clearValueCount = 1;
     rp_bi.pClearValues = &clear_color;
-    vkCmdBeginRenderPass(command_buffer, &rp_bi, VK_SUBPASS_CONTENTS_INLINE);
-
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline);
-
-    VkBuffer vertex_buffers[] { vertex_buffer };
-    VkDeviceSize offsets[] { 0 };
-    vkCmdBindVertexBuffers(command_buffer, 0, 1, vertex_buffers, offsets);
+    vkCmdBeginRenderPass(command_buffer, &rp_bi, render_pass_contents);
 
-    vkCmdDraw(command_buffer, num_vertices, 1, 0, 0);
+    record_render_pass(command_buffer);
 
     // End command buffer recording
     vkCmdEndRenderPass(command_buffer);
+
+    if(timestamps) {
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamps->query_pool, timestamps->first_query + 2);
+    }
+
+    if(record_after_render_pass) {
+        record_after_render_pass(command_buffer);
+    }
+
     if(vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
         throw std::runtime_error("Failed to record command buffer.");
     }
 }
 
+// Records the draws of a frame, including the dynamic states, inside a render
+// pass.
+inline void record_draw_commands(
+    VkExtent2D      swap_chain_extent,
+    VkCommandBuffer command_buffer,
+    // Layout of both pipelines, with the camera set layout
+    VkPipelineLayout pipeline_layout,
+    VkDescriptorSet  camera_set,
+    // Plain vertices
+    VkPipeline      vertex_pipeline,
+    VkBuffer        vertex_buffer,
+    VkDeviceSize    vertex_buffer_offset,
+    std::size_t     num_vertices,
+    // Instanced meshes
+    VkPipeline      instanced_pipeline,
+    VkBuffer        mesh_buffer,
+    VkBuffer        mesh_index_buffer,
+    const std::vector< InstanceBufferDraws >& instanced_draws
+) {
+    // Dynamic states of all pipelines
+    VkViewport viewport {};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = swap_chain_extent.width;
+    viewport.height = swap_chain_extent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
 
-// Command pool and buffers
+    VkRect2D scissor {};
+    scissor.offset = {0, 0};
+    scissor.extent = swap_chain_extent;
+    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+    // Stays bound across pipelines with compatible layouts
+    vkCmdBindDescriptorSets(
+        command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout,
+        0, 1, &camera_set, 0, nullptr
+    );
+
+    if(num_vertices) {
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vertex_pipeline);
+
+        VkBuffer vertex_buffers[] { vertex_buffer };
+        VkDeviceSize offsets[] { vertex_buffer_offset };
+        vkCmdBindVertexBuffers(command_buffer, 0, 1, vertex_buffers, offsets);
+
+        vkCmdDraw(command_buffer, num_vertices, 1, 0, 0);
+    }
+
+    bool instanced_pipeline_bound = false;
+    for(const auto& group : instanced_draws) {
+        if(group.draws.empty() && group.indirect_buffer == VK_NULL_HANDLE) continue;
+
+        if(!instanced_pipeline_bound) {
+            vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, instanced_pipeline);
+            vkCmdBindIndexBuffer(command_buffer, mesh_index_buffer, 0, VK_INDEX_TYPE_UINT16);
+            instanced_pipeline_bound = true;
+        }
+
+        // Binding 0: mesh vertices; binding 1: instance data
+        VkBuffer vertex_buffers[] { mesh_buffer, group.instance_buffer };
+        VkDeviceSize offsets[] { 0, group.instance_buffer_offset };
+        vkCmdBindVertexBuffers(command_buffer, 0, 2, vertex_buffers, offsets);
+
+        for(const auto& draw : group.draws) {
+            if(draw.num_instances == 0) continue;
+            vkCmdDrawIndexed(command_buffer, draw.num_indices, draw.num_instances, draw.first_index, draw.vertex_offset, draw.first_instance);
+        }
+        if(group.indirect_buffer != VK_NULL_HANDLE) {
+            vkCmdDrawIndexedIndirect(command_buffer, group.indirect_buffer, 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+        }
+    }
+}
+
+// Records the draws into a command buffer executed inside the render pass.
+// The framebuffer is not specified, so that the command buffer can be
+// executed with any framebuffer compatible with the render pass.
+inline void record_secondary_draw_command_buffer(
+    VkExtent2D      swap_chain_extent,
+    VkRenderPass    render_pass,
+    VkCommandBuffer command_buffer,
+    VkPipelineLayout pipeline_layout,
+    VkDescriptorSet  camera_set,
+    VkPipeline      vertex_pipeline,
+    VkBuffer        vertex_buffer,
+    VkDeviceSize    vertex_buffer_offset,
+    std::size_t     num_vertices,
+    VkPipeline      instanced_pipeline,
+    VkBuffer        mesh_buffer,
+    VkBuffer        mesh_index_buffer,
+    const std::vector< InstanceBufferDraws >& instanced_draws
+) {
+    VkCommandBufferInheritanceInfo ii {};
+    ii.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    ii.renderPass = render_pass;
+    ii.subpass = 0;
+    ii.framebuffer = VK_NULL_HANDLE;
+
+    VkCommandBufferBeginInfo cb_bi {};
+    cb_bi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    cb_bi.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    cb_bi.pInheritanceInfo = &ii;
+
+    if(vkBeginCommandBuffer(command_buffer, &cb_bi) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin recording command buffer.");
+    }
+
+    record_draw_commands(
+        swap_chain_extent,
+        command_buffer,
+        pipeline_layout,
+        camera_set,
+        vertex_pipeline,
+        vertex_buffer,
+        vertex_buffer_offset,
+        num_vertices,
+        instanced_pipeline,
+        mesh_buffer,
+        mesh_index_buffer,
+        instanced_draws
+    );
+
+    if(vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to record command buffer.");
+    }
+}
+
+inline void record_graphics_command_buffer(
+    VkExtent2D      swap_chain_extent,
+    VkRenderPass    render_pass,
+    VkFramebuffer   framebuffer,
+    VkCommandBuffer command_buffer,
+    VkPipelineLayout pipeline_layout,
+    VkDescriptorSet  camera_set,
+    // Plain vertices
+    VkPipeline      vertex_pipeline,
+    VkBuffer        vertex_buffer,
+    VkDeviceSize    vertex_buffer_offset,
+    std::size_t     num_vertices,
+    // Instanced meshes
+    VkPipeline      instanced_pipeline,
+    VkBuffer        mesh_buffer,
+    VkBuffer        mesh_index_buffer,
+    const std::vector< InstanceBufferDraws >& instanced_draws,
+    // See record_frame_command_buffer
+    const std::function< void(VkCommandBuffer) >& record_before_render_pass = {},
+    const std::function< void(VkCommandBuffer) >& record_after_render_pass = {},
+    const std::optional< TimestampQueries >& timestamps = std::nullopt
+) {
+    record_frame_command_buffer(
+        swap_chain_extent,
+        render_pass,
+        framebuffer,
+        command_buffer,
+        VK_SUBPASS_CONTENTS_INLINE,
+        [&](VkCommandBuffer cb) {
+            record_draw_commands(
+                swap_chain_extent,
+                cb,
+                pipeline_layout,
+                camera_set,
+                vertex_pipeline,
+                vertex_buffer,
+                vertex_buffer_offset,
+                num_vertices,
+                instanced_pipeline,
+                mesh_buffer,
+                mesh_index_buffer,
+                instanced_draws
+            );
+        },
+        record_before_render_pass,
+        record_after_render_pass,
+        timestamps
+    );
+}
+
+// Records a primary command buffer executing secondary command buffers, in
+// order, inside the render pass.
+inline void record_graphics_command_buffer(
+    VkExtent2D      swap_chain_extent,
+    VkRenderPass    render_pass,
+    VkFramebuffer   framebuffer,
+    VkCommandBuffer command_buffer,
+    const std::vector< VkCommandBuffer >& secondary_command_buffers,
+    // See record_frame_command_buffer
+    const std::function< void(VkCommandBuffer) >& record_before_render_pass = {},
+    const std::function< void(VkCommandBuffer) >& record_after_render_pass = {},
+    const std::optional< TimestampQueries >& timestamps = std::nullopt
+) {
+    record_frame_command_buffer(
+        swap_chain_extent,
+        render_pass,
+        framebuffer,
+        command_buffer,
+        VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS,
+        [&](VkCommandBuffer cb) {
+            if(!secondary_command_buffers.empty()) {
+                vkCmdExecuteCommands(cb, secondary_command_buffers.size(), secondary_command_buffers.data());
+            }
+        },
+        record_before_render_pass,
+        record_after_render_pass,
+        timestamps
+    );
+}
+
+// Synchronization objects
 //-----------------------------------------------------------------------------
+inline auto create_semaphore(VkDevice dev) {
+    VkSemaphore semaphore;
+
+    VkSemaphoreCreateInfo ci {};
+    ci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    if(vkCreateSemaphore(dev, &ci, nullptr, &semaphore) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create semaphore.");
+    }
+
+    return semaphore;
+}
+inline auto create_fence(VkDevice dev, bool signaled) {
+    VkFence fence;
+
+    VkFenceCreateInfo ci {};
+    ci.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    ci.flags = signaled ? VK_FENCE_CREATE_SIGNALED_BIT : 0;
+
+    if(vkCreateFence(dev, &ci, nullptr, &fence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create fence.");
+    }
+
+    return fence;
+}
+
 template< std::size_t max_frames >
 inline auto create_sync_objs(
     VkDevice dev,
@@ -1,142 +1,513 @@
 #ifndef PGW_VISUAL_VK_VERTEX_BUFFER_MANAGER_HPP
 #define PGW_VISUAL_VK_VERTEX_BUFFER_MANAGER_HPP
 
+#include <algorithm> // fill, max, min, transform
+#include <array>
+#include <cstdint>
+#include <cstring> // memcmp, memcpy
+#include <deque>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <type_traits> // invoke_result_t, is_trivially_copyable_v
+#include <utility> // pair
+#include <vector>
+
 #include "visual/vk-utils.hpp"
 
 namespace pgw {
 namespace vk_util {
 
+// Manages a device buffer with a region per frame in flight, uploaded through
+// a staging buffer, or written directly if the device buffer is host visible.
 class VertexBufferManager {
 public:
+    // Granularity of the comparison with the previous data of a region
+    constexpr static VkDeviceSize diff_block_size = 256;
+    // More dirty ranges are transferred as one range
+    constexpr static std::size_t  max_copy_regions = 64;
+    // The buffers shrink after this many uploads in a row using at most a
+    // quarter of the capacity
+    constexpr static std::size_t  shrink_delay = 600;
+
+    // Memory written by the host and read by the device without a copy,
+    // found on integrated GPUs, with resizable BAR, and on software drivers
+    constexpr static VkMemoryPropertyFlags direct_write_memory_properties =
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
 
     struct CopyDataResult {
         bool buffer_reallocated = false;
     };
 
     VertexBufferManager(
-        VkPhysicalDevice phys_dev,
+        MemoryAllocator& allocator,
         VkDevice         device,
+        const QueueFamilyIndices& qf_indices,
         VkCommandPool    command_pool,
         VkQueue          transfer_queue,
-        VkDeviceSize     initial_size = 1024
+        std::size_t      num_frames,
+        VkDeviceSize     initial_size = 1024,
+        // Write into the device buffer if its memory can be host visible
+        bool             allow_direct_write = true
     ) :
-        phys_dev_(phys_dev),
+        allocator_(allocator),
         device_(device),
         command_pool_(command_pool),
         transfer_queue_(transfer_queue),
-        buffer_size_(initial_size)
+        queue_families_(transfer_graphics_families(qf_indices)),
+        num_frames_(num_frames),
+        direct_write_(
+            allow_direct_write
+            && buffer_memory_supported(allocator, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, direct_write_memory_properties)
+        ),
+        initial_size_(initial_size),
+        buffer_size_(initial_size),
+        used_sizes_(num_frames),
+        nums_vertices_(num_frames),
+        synced_sizes_(num_frames),
+        dirty_regions_(num_frames),
+        uploaded_sizes_(num_frames),
+        transfer_semaphores_(num_frames),
+        transfer_fences_(num_frames),
+        transfer_pending_(num_frames),
+        nums_transfers_(num_frames)
     {
         create_buffers_();
+
+        transfer_command_buffers_ = allocate_command_buffers(device_, command_pool_, num_frames_);
+        for(std::size_t i = 0; i < num_frames_; ++i) {
+            transfer_semaphores_[i] = create_semaphore(device_);
+            transfer_fences_[i] = create_fence(device_, true);
+        }
     }
 
     ~VertexBufferManager() {
-        destroy_buffers_();
+        for(std::size_t i = 0; i < num_frames_; ++i) {
+            vkDestroyFence(device_, transfer_fences_[i], nullptr);
+            vkDestroySemaphore(device_, transfer_semaphores_[i], nullptr);
+        }
+        vkFreeCommandBuffers(device_, command_pool_, num_frames_, transfer_command_buffers_.data());
+
+        for(auto& retired : retired_) {
+            destroy_buffers_(retired.buffers);
+        }
+        destroy_buffers_(buffers_);
     }
 
+    // Copies the vertex data into the region of the given frame, and
+    // transfers the parts that differ from the data last transferred to the
+    // region.
+    //
+    // The caller must ensure that the GPU is no longer using the region of
+    // this frame, typically by waiting for the in-flight fence of the frame.
+    //
+    // If timestamps are given, the transfer is measured with them (see
+    // submit_copy_buffer).
     template< typename Vertex >
-    CopyDataResult copy_data(const std::vector< Vertex >& vertex_data) {
+    CopyDataResult copy_data(
+        const std::vector< Vertex >& vertex_data,
+        std::size_t                  frame,
+        const std::optional< TimestampQueries >& timestamps = std::nullopt
+    ) {
+        static_assert(std::is_trivially_copyable_v< Vertex >);
         CopyDataResult res {};
 
-        const auto new_num_vertices = vertex_data.size();
-        const auto new_used_size    = new_num_vertices * sizeof(Vertex);
+        resize_region_(vertex_data.size(), sizeof(Vertex), frame, &res);
+        dirty_regions_[frame].clear();
+        write_changes_(frame, 0, vertex_data.data(), vertex_data.size() * sizeof(Vertex));
+        submit_data(frame, timestamps);
 
-        if(new_used_size > buffer_size_) {
-            // Need reallocation
-            vkDeviceWaitIdle(device_);
+        return res;
+    }
 
-            destroy_buffers_();
+    // Copies the vertex data into the region of the given frame, converting
+    // each vertex with convert, such as into a packed device layout. Vertices
+    // are converted a block at a time, and only the blocks that changed are
+    // written and transferred, as in copy_data.
+    //
+    // The same requirement as in copy_data applies.
+    template< typename Vertex, typename Convert >
+    CopyDataResult copy_converted_data(
+        const std::vector< Vertex >& vertex_data,
+        std::size_t                  frame,
+        Convert&&                    convert,
+        const std::optional< TimestampQueries >& timestamps = std::nullopt
+    ) {
+        using DeviceVertex = std::invoke_result_t< Convert&, const Vertex& >;
+        static_assert(std::is_trivially_copyable_v< DeviceVertex >);
+        constexpr std::size_t block_vertices = std::max< std::size_t >(diff_block_size / sizeof(DeviceVertex), 1);
 
-            // Current strategy: expand the buffer size by a factor of 2
-            while(buffer_size_ < new_used_size) buffer_size_ *= 2;
-            create_buffers_();
+        CopyDataResult res {};
+
+        const auto num_vertices = vertex_data.size();
+        resize_region_(num_vertices, sizeof(DeviceVertex), frame, &res);
+        dirty_regions_[frame].clear();
 
-            res.buffer_reallocated = true;
+        std::array< DeviceVertex, block_vertices > converted;
+        for(std::size_t first = 0; first < num_vertices; first += block_vertices) {
+            const auto count = std::min(block_vertices, num_vertices - first);
+            std::transform(vertex_data.begin() + first, vertex_data.begin() + first + count, converted.begin(), convert);
+            write_changes_(frame, first * sizeof(DeviceVertex), converted.data(), count * sizeof(DeviceVertex));
         }
+        submit_data(frame, timestamps);
+
+        return res;
+    }
 
-        // Copy data to staging buffer
-        {
-            void* p_data;
-            vkMapMemory(device_, staging_memory_, 0, new_used_size, 0, &p_data);
-            std::memcpy(p_data, vertex_data.data(), new_used_size);
-            vkUnmapMemory(device_, staging_memory_);
+    // Returns the mapped region of the given frame, in the staging buffer or
+    // in the device buffer if written directly, as storage for
+    // num_vertices vertices, growing the buffers if needed. The vertices can
+    // be written there directly, instead of being built in a separate vector
+    // and copied. Call submit_data when done, which transfers the whole
+    // region, since the changes are not known.
+    //
+    // The same requirement as in copy_data applies.
+    template< typename Vertex >
+    std::span< Vertex > map_data(std::size_t num_vertices, std::size_t frame, CopyDataResult* p_res = nullptr) {
+        resize_region_(num_vertices, sizeof(Vertex), frame, p_res);
+
+        // The staging region no longer matches the device region
+        synced_sizes_[frame] = 0;
+        dirty_regions_[frame].clear();
+        add_dirty_region_(frame, 0, used_sizes_[frame]);
+
+        return {
+            reinterpret_cast< Vertex* >(static_cast< char* >(p_host_data_) + offset(frame)),
+            num_vertices
+        };
+    }
+
+    // Transfers the dirty parts of the staging region of the given frame,
+    // written by map_data or the copy functions, to the device buffer, in one
+    // submission. Nothing is submitted if nothing changed, and the region of
+    // the device buffer keeps its data.
+    void submit_data(
+        std::size_t frame,
+        const std::optional< TimestampQueries >& timestamps = std::nullopt
+    ) {
+        auto& regions = dirty_regions_[frame];
+        uploaded_sizes_[frame] = 0;
+
+        // Already in the device buffer
+        if(direct_write_) {
+            uploaded_sizes_[frame] = used_sizes_[frame];
+            regions.clear();
+            return;
+        }
+
+        if(regions.empty()) return;
+
+        // Too many small copies cost more than the bytes in between
+        if(regions.size() > max_copy_regions) {
+            const auto last = regions.back();
+            regions.resize(1);
+            regions[0].size = last.srcOffset + last.size - regions[0].srcOffset;
         }
+        for(const auto& r : regions) uploaded_sizes_[frame] += r.size;
 
-        // Transfer data from staging buffer to device buffer
-        copy_buffer(
-            device_,
-            command_pool_,
+        // Transfer data from staging buffer to device buffer.
+        //
+        // The fence was waited for before the region was written (see
+        // wait_transfer_), and no other submission signals it in between.
+        vkResetFences(device_, 1, &transfer_fences_[frame]);
+
+        // If the previous signal was never consumed (e.g. the frame was
+        // skipped), consume it here before signaling again.
+        submit_copy_buffer(
+            transfer_command_buffers_[frame],
             transfer_queue_,
-            staging_buffer_,
-            buffer_,
-            new_used_size
+            buffers_.staging_buffer,
+            buffers_.buffer,
+            regions,
+            transfer_pending_[frame] ? transfer_semaphores_[frame] : VK_NULL_HANDLE,
+            transfer_semaphores_[frame],
+            transfer_fences_[frame],
+            timestamps
         );
+        transfer_pending_[frame] = true;
+        ++nums_transfers_[frame];
 
-        // Set variables
-        used_size_ = new_used_size;
-        num_vertices_ = new_num_vertices;
+        regions.clear();
+        synced_sizes_[frame] = used_sizes_[frame];
+    }
 
-        return res;
+    // Destroys the buffers replaced by a reallocation once no frame can use
+    // them. Call once per frame, after waiting for the in-flight fence of the
+    // frame.
+    void release_retired() {
+        for(auto& retired : retired_) {
+            if(retired.frames_left > 0) --retired.frames_left;
+        }
+        while(!retired_.empty() && retired_.front().frames_left == 0) {
+            // Transfers into the old buffers whose semaphores were never
+            // waited for are not covered by the frame fences. A transfer
+            // that is no longer the last one of its frame was waited for
+            // before the next one (see wait_transfer_).
+            for(const auto& [frame, num_transfers] : retired_.front().pending_transfers) {
+                if(nums_transfers_[frame] == num_transfers) {
+                    vkWaitForFences(device_, 1, &transfer_fences_[frame], VK_TRUE, UINT64_MAX);
+                }
+            }
+            destroy_buffers_(retired_.front().buffers);
+            retired_.pop_front();
+        }
+    }
+
+    // Returns the semaphore signaled by the pending transfer of the frame, or
+    // VK_NULL_HANDLE if there is none. The caller must wait for the returned
+    // semaphore before reading the region of the frame.
+    VkSemaphore take_transfer_semaphore(std::size_t frame) {
+        if(!transfer_pending_[frame]) return VK_NULL_HANDLE;
+
+        transfer_pending_[frame] = false;
+        return transfer_semaphores_[frame];
     }
 
     // Accessors
     auto capacity() const { return buffer_size_; }
-    auto num_vertices() const { return num_vertices_; }
-    auto size() const { return used_size_; }
-    auto buffer() const { return buffer_; }
+    auto num_frames() const { return num_frames_; }
+    auto num_vertices(std::size_t frame) const { return nums_vertices_[frame]; }
+    auto size(std::size_t frame) const { return used_sizes_[frame]; }
+    // Bytes transferred, or written directly, by the last submission of the
+    // frame
+    auto uploaded_size(std::size_t frame) const { return uploaded_sizes_[frame]; }
+    bool direct_write() const { return direct_write_; }
+    auto buffer() const { return buffers_.buffer; }
+    // The offset of the region of the frame, in both staging and device buffers.
+    VkDeviceSize offset(std::size_t frame) const { return frame * buffer_size_; }
 
 private:
+    struct Buffers {
+        // The device vertex buffer (actual storage)
+        VkBuffer         buffer = VK_NULL_HANDLE;
+        MemoryAllocation memory;
+        // The transfer vertex buffer, unless written directly
+        VkBuffer         staging_buffer = VK_NULL_HANDLE;
+        MemoryAllocation staging_memory;
+    };
+    struct RetiredBuffers {
+        Buffers     buffers;
+        std::size_t frames_left; // Until it is no longer in use
+        // Transfers into the buffers not yet completed on retirement, as the
+        // frame and its number of transfers then
+        std::vector< std::pair< std::size_t, std::uint64_t > > pending_transfers;
+    };
+
+    // Sets the size of the region of the frame, growing the buffers if
+    // needed, or shrinking them after a long time of low usage.
+    //
+    // Growth is by doubling, and shrinking, after shrink_delay uploads of at
+    // most a quarter of the capacity, leaves the capacity at least twice the
+    // highest of these uploads. Usage right after either is then between the
+    // two thresholds, so that sizes around one of them do not keep
+    // reallocating.
+    void resize_region_(std::size_t num_vertices, std::size_t vertex_size, std::size_t frame, CopyDataResult* p_res) {
+        // Every write to the region goes through here first
+        wait_transfer_(frame);
+
+        const auto new_used_size = num_vertices * vertex_size;
+
+        if(new_used_size > buffer_size_) {
+            auto new_size = buffer_size_;
+            while(new_size < new_used_size) new_size *= 2;
+            reallocate_(new_size, p_res);
+        } else if(buffer_size_ > initial_size_ && new_used_size <= buffer_size_ / 4) {
+            low_usage_peak_ = std::max(low_usage_peak_, new_used_size);
+            if(++num_low_usage_uploads_ >= shrink_delay) {
+                auto new_size = buffer_size_;
+                while(new_size / 2 >= initial_size_ && new_size / 2 >= 2 * low_usage_peak_) new_size /= 2;
+                reallocate_(new_size, p_res);
+            }
+        } else {
+            num_low_usage_uploads_ = 0;
+            low_usage_peak_ = 0;
+        }
+
+        // Set variables
+        used_sizes_[frame] = new_used_size;
+        nums_vertices_[frame] = num_vertices;
+    }
+
+    // Waits for the last transfer from the staging region of the frame, so
+    // that the host neither overwrites nor compares with data the device may
+    // still be reading.
+    //
+    // The fence is normally already signaled, because the graphics work of
+    // the frame waited for the transfer. But the in-flight fences do not
+    // cover a transfer whose graphics submission was skipped, such as when
+    // the swap chain is out of date, or an earlier transfer in the same
+    // frame.
+    void wait_transfer_(std::size_t frame) {
+        vkWaitForFences(device_, 1, &transfer_fences_[frame], VK_TRUE, UINT64_MAX);
+    }
+
+    // Replaces the buffers with buffers of the new region capacity, without
+    // waiting for the device. The old buffers may still be read by frames in
+    // flight, so they are retired until those frames have completed (see
+    // release_retired).
+    void reallocate_(VkDeviceSize new_size, CopyDataResult* p_res) {
+        auto& retired = retired_.emplace_back(RetiredBuffers { buffers_, num_frames_, {} });
+        for(std::size_t i = 0; i < num_frames_; ++i) {
+            if(vkGetFenceStatus(device_, transfer_fences_[i]) == VK_NOT_READY) {
+                retired.pending_transfers.push_back({ i, nums_transfers_[i] });
+            }
+        }
+        buffers_ = {};
+
+        buffer_size_ = new_size;
+        create_buffers_();
+
+        // Regions of other frames are lost with the old buffers, and are
+        // written again when their frames come around
+        std::fill(used_sizes_.begin(), used_sizes_.end(), 0);
+        std::fill(nums_vertices_.begin(), nums_vertices_.end(), 0);
+        std::fill(synced_sizes_.begin(), synced_sizes_.end(), 0);
+        for(auto& regions : dirty_regions_) regions.clear();
+
+        num_low_usage_uploads_ = 0;
+        low_usage_peak_ = 0;
+
+        if(p_res) p_res->buffer_reallocated = true;
+    }
+
+    // Writes the data at the offset of the region of the frame, and marks
+    // the blocks that differ from the staging region as dirty. Data past the
+    // synced part of the region is always dirty.
+    void write_changes_(std::size_t frame, VkDeviceSize data_offset, const void* p_data, VkDeviceSize size) {
+        const auto p_src = static_cast< const char* >(p_data);
+        const auto p_dst = static_cast< char* >(p_host_data_) + offset(frame) + data_offset;
+
+        if(direct_write_) {
+            std::memcpy(p_dst, p_src, size);
+            return;
+        }
+
+        const auto synced_end = std::max(synced_sizes_[frame], data_offset);
+        const auto compared = std::min(size, synced_end - data_offset);
+        for(VkDeviceSize begin = 0; begin < compared; begin += diff_block_size) {
+            const auto n = std::min(diff_block_size, compared - begin);
+            if(std::memcmp(p_dst + begin, p_src + begin, n) != 0) {
+                std::memcpy(p_dst + begin, p_src + begin, n);
+                add_dirty_region_(frame, data_offset + begin, n);
+            }
+        }
+        if(compared < size) {
+            std::memcpy(p_dst + compared, p_src + compared, size - compared);
+            add_dirty_region_(frame, data_offset + compared, size - compared);
+        }
+    }
+
+    // Regions are added in increasing order, and adjacent ones are merged.
+    void add_dirty_region_(std::size_t frame, VkDeviceSize region_offset, VkDeviceSize size) {
+        if(size == 0) return;
+
+        auto& regions = dirty_regions_[frame];
+        const auto buffer_offset = offset(frame) + region_offset;
+        if(!regions.empty() && regions.back().srcOffset + regions.back().size == buffer_offset) {
+            regions.back().size += size;
+        } else {
+            regions.push_back({ buffer_offset, buffer_offset, size });
+        }
+    }
 
     void create_buffers_() {
+        if(direct_write_) {
+            try {
+                std::tie(
+                    buffers_.buffer,
+                    buffers_.memory
+                ) = create_buffer(
+                    allocator_,
+                    buffer_size_ * num_frames_,
+                    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                    direct_write_memory_properties
+                );
+
+                p_host_data_ = buffers_.memory.p_mapped;
+                return;
+            } catch(const std::runtime_error&) {
+                // The heap is exhausted. Regions are not synced yet, so the
+                // staging path starts by transferring them whole.
+                direct_write_ = false;
+            }
+        }
+
         std::tie(
-            staging_buffer_,
-            staging_memory_
+            buffers_.staging_buffer,
+            buffers_.staging_memory
         ) = create_buffer(
-            phys_dev_,
-            device_,
-            buffer_size_,
+            allocator_,
+            buffer_size_ * num_frames_,
             VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
         );
 
         std::tie(
-            buffer_,
-            memory_
+            buffers_.buffer,
+            buffers_.memory
         ) = create_buffer(
-            phys_dev_,
-            device_,
-            buffer_size_,
+            allocator_,
+            buffer_size_ * num_frames_,
             VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            // Unchanged parts are kept across transfers and draws
+            queue_families_
         );
-    }
 
-    void destroy_buffers_() {
-        vkDestroyBuffer(device_, buffer_, nullptr);
-        vkFreeMemory(device_, memory_, nullptr);
+        p_host_data_ = buffers_.staging_memory.p_mapped;
+    }
 
-        vkDestroyBuffer(device_, staging_buffer_, nullptr);
-        vkFreeMemory(device_, staging_memory_, nullptr);
+    void destroy_buffers_(const Buffers& buffers) {
+        if(buffers.buffer != VK_NULL_HANDLE) {
+            destroy_buffer(allocator_, buffers.buffer, buffers.memory);
+        }
+        if(buffers.staging_buffer != VK_NULL_HANDLE) {
+            destroy_buffer(allocator_, buffers.staging_buffer, buffers.staging_memory);
+        }
     }
 
 
     // The environment (not changed)
-    VkPhysicalDevice phys_dev_;
+    MemoryAllocator& allocator_;
     VkDevice         device_;
     VkCommandPool    command_pool_; // Used for buffer copying
     VkQueue          transfer_queue_; // Used for buffer copying
+    std::vector< std::uint32_t > queue_families_; // Sharing the device buffer
+    std::size_t      num_frames_; // Number of regions in the buffers
+    bool             direct_write_; // No staging buffer. Can only become false.
+
+    // The buffers
+    Buffers        buffers_;
+    // The staging buffer, or the device buffer if written directly.
+    // Persistently mapped.
+    void*          p_host_data_ = nullptr;
+    VkDeviceSize   initial_size_;
+    VkDeviceSize   buffer_size_; // The capacity of each region
+
+    // Replaced buffers, possibly still used by frames in flight
+    std::deque< RetiredBuffers > retired_;
+    // Shrink policy
+    std::size_t    num_low_usage_uploads_ = 0;
+    VkDeviceSize   low_usage_peak_ = 0;
 
-    // The transfer vertex buffer
-    VkBuffer       staging_buffer_;
-    VkDeviceMemory staging_memory_;
-    VkDeviceSize   buffer_size_; // The capacity of the buffer
+    // The actual data stored in each region
+    std::vector< VkDeviceSize >  used_sizes_;
+    std::vector< std::uint32_t > nums_vertices_;
 
-    // The device vertex buffer (actual storage)
-    VkBuffer       buffer_;
-    VkDeviceMemory memory_;
+    // Incremental transfers of each region. The staging and device regions
+    // hold the same data up to the synced size, once the last transfer of
+    // the region has completed, so new data is compared with the staging
+    // region to find the parts to transfer.
+    std::vector< VkDeviceSize >                synced_sizes_;
+    std::vector< std::vector< VkBufferCopy > > dirty_regions_; // Not yet transferred
+    std::vector< VkDeviceSize >                uploaded_sizes_;
 
-    // The actual data stored
-    VkDeviceSize   used_size_ = 0;
-    std::uint32_t  num_vertices_ = 0;
+    // Transfer synchronization for each region
+    std::vector< VkCommandBuffer > transfer_command_buffers_;
+    std::vector< VkSemaphore >     transfer_semaphores_;
+    std::vector< VkFence >         transfer_fences_;
+    std::vector< bool >            transfer_pending_; // Signaled but not yet consumed
+    std::vector< std::uint64_t >   nums_transfers_; // Submitted so far
 };
 
 } // namespace vk_util
@@ -0,0 +1,109 @@
+#ifndef PGW_VISUAL_VK_VERTEX_FORMAT_HPP
+#define PGW_VISUAL_VK_VERTEX_FORMAT_HPP
+
+#include <array>
+#include <cstdint>
+
+#include <glm/gtc/packing.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "visual-common.hpp"
+
+namespace pgw {
+namespace vk_util {
+
+//-------------------------------------
+// Packed attribute types
+//-------------------------------------
+// Two half floats, read as a vec2 by shaders.
+struct Half2 {
+    std::uint32_t packed = 0;
+
+    static Half2 pack(const glm::vec2& v) {
+        return { glm::packHalf2x16(v) };
+    }
+};
+
+// Four unsigned normalized bytes, read as a vec4 (or fewer components) with
+// values in [0, 1] by shaders.
+struct Unorm8x4 {
+    std::uint32_t packed = 0;
+
+    static Unorm8x4 pack(const glm::vec4& v) {
+        return { glm::packUnorm4x8(v) };
+    }
+    static Unorm8x4 pack(const glm::vec3& v) {
+        return pack(glm::vec4(v.x, v.y, v.z, 1.0f));
+    }
+};
+
+// The format of a vertex attribute of type T. Packed types put the first
+// component in the lowest bits, which is the order of Vulkan formats in memory
+// on little endian hosts.
+template< typename T > constexpr VkFormat vertex_attr_format = VK_FORMAT_UNDEFINED;
+template<> constexpr VkFormat vertex_attr_format< float >     = VK_FORMAT_R32_SFLOAT;
+template<> constexpr VkFormat vertex_attr_format< glm::vec2 > = VK_FORMAT_R32G32_SFLOAT;
+template<> constexpr VkFormat vertex_attr_format< glm::vec3 > = VK_FORMAT_R32G32B32_SFLOAT;
+template<> constexpr VkFormat vertex_attr_format< glm::vec4 > = VK_FORMAT_R32G32B32A32_SFLOAT;
+template<> constexpr VkFormat vertex_attr_format< Half2 >     = VK_FORMAT_R16G16_SFLOAT;
+template<> constexpr VkFormat vertex_attr_format< Unorm8x4 >  = VK_FORMAT_R8G8B8A8_UNORM;
+
+//-------------------------------------
+// Vertex input layouts
+//-------------------------------------
+// A field of a vertex structure, of type T at the byte offset.
+template< typename T, std::uint32_t offset_ >
+struct VertexAttr {
+    constexpr static VkFormat      format = vertex_attr_format< T >;
+    constexpr static std::uint32_t offset = offset_;
+
+    static_assert(format != VK_FORMAT_UNDEFINED, "Unsupported vertex attribute type.");
+};
+
+// The vertex input descriptions of a vertex structure, derived from its
+// fields. Attributes are at consecutive locations in the order of the
+// fields. For example:
+//
+//   using VertexLayout = VertexInputLayout<
+//       Vertex, VK_VERTEX_INPUT_RATE_VERTEX,
+//       VertexAttr< glm::vec2, offsetof(Vertex, pos) >,
+//       VertexAttr< glm::vec3, offsetof(Vertex, color) >
+//   >;
+template< typename Vertex, VkVertexInputRate input_rate, typename... Attrs >
+struct VertexInputLayout {
+    using vertex_type = Vertex;
+    constexpr static std::uint32_t num_attrs = sizeof...(Attrs);
+
+    static_assert(((Attrs::offset < sizeof(Vertex)) && ...), "Vertex attribute out of the vertex.");
+
+    constexpr static auto get_binding_desc(std::uint32_t binding) {
+        VkVertexInputBindingDescription bd {};
+
+        bd.binding = binding;
+        bd.stride = sizeof(Vertex);
+        bd.inputRate = input_rate;
+
+        return bd;
+    }
+
+    constexpr static auto get_attr_desc(std::uint32_t binding, std::uint32_t first_location = 0) {
+        std::array< VkVertexInputAttributeDescription, num_attrs > ad {};
+
+        std::uint32_t i = 0;
+        ((
+            ad[i].binding = binding,
+            ad[i].location = first_location + i,
+            ad[i].format = Attrs::format,
+            ad[i].offset = Attrs::offset,
+            ++i
+        ), ...);
+        return ad;
+    }
+};
+
+} // namespace vk_util
+} // namespace pgw
+
+#endif
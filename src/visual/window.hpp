@@ -1,47 +1,118 @@
 #ifndef PGW_VISUAL_WINDOW_HPP
 #define PGW_VISUAL_WINDOW_HPP
 
+#include <algorithm> // min, stable_sort, transform
+#include <cstddef> // offsetof
 #include <cstdint>
 #include <iostream>
+#include <iterator> // back_inserter
+#include <optional>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits> // conditional_t
 #include <utility> // move
 
+#include "camera.hpp"
 #include "glfw-utils.hpp"
+#include "utility/frame-profiler.hpp"
 #include "visual-common.hpp"
+#include "vk-camera-buffer-manager.hpp"
+#include "vk-draw-command-cache.hpp"
+#include "vk-gpu-timer.hpp"
+#include "vk-mesh-buffer-manager.hpp"
+#include "vk-particle-compute-manager.hpp"
+#include "vk-pipeline-cache-manager.hpp"
 #include "vk-swap-chain-manager.hpp"
 #include "vk-utils.hpp"
 #include "vk-vertex-buffer-manager.hpp"
+#include "vk-vertex-format.hpp"
 
 namespace pgw {
 
+// A vertex as built on the host.
 struct Vertex {
     glm::vec2 pos;
     glm::vec3 color;
+};
+using VertexLayout = vk_util::VertexInputLayout<
+    Vertex, VK_VERTEX_INPUT_RATE_VERTEX,
+    vk_util::VertexAttr< glm::vec2, offsetof(Vertex, pos) >,
+    vk_util::VertexAttr< glm::vec3, offsetof(Vertex, color) >
+>;
+
+// A vertex with a half float position and an 8-bit color, 8 bytes instead of
+// 20. Half floats keep about 3 significant digits, which is below a pixel for
+// positions in [-1, 1]. The shaders read the same vec2 position and vec3
+// color from either layout.
+struct PackedVertex {
+    vk_util::Half2    pos;
+    vk_util::Unorm8x4 color;
+
+    PackedVertex() = default;
+    explicit PackedVertex(const Vertex& v) :
+        pos(vk_util::Half2::pack(v.pos)),
+        color(vk_util::Unorm8x4::pack(v.color))
+    {}
+};
+static_assert(sizeof(PackedVertex) == 8);
+using PackedVertexLayout = vk_util::VertexInputLayout<
+    PackedVertex, VK_VERTEX_INPUT_RATE_VERTEX,
+    vk_util::VertexAttr< vk_util::Half2, offsetof(PackedVertex, pos) >,
+    vk_util::VertexAttr< vk_util::Unorm8x4, offsetof(PackedVertex, color) >
+>;
+
+// The layout of vertices in device buffers, selected at compile time.
+// Vertices are converted from the host layout when they are uploaded.
+constexpr bool use_packed_vertices = true;
+using DeviceVertexLayout = std::conditional_t< use_packed_vertices, PackedVertexLayout, VertexLayout >;
+using DeviceVertex = DeviceVertexLayout::vertex_type;
+
+inline DeviceVertex to_device_vertex(const Vertex& v) {
+    return DeviceVertex(v);
+}
+
+// Per-instance data for drawing a mesh, matching the shape transform in the
+// instanced vertex shader.
+struct InstanceData {
+    float     rotation = 0;
+    glm::vec2 scale { 1.0f, 1.0f };
+    glm::vec2 offset { 0.0f, 0.0f };
+    glm::vec2 position { 0.0f, 0.0f };
+    glm::vec3 color { 1.0f, 1.0f, 1.0f };
+};
+using InstanceDataLayout = vk_util::VertexInputLayout<
+    InstanceData, VK_VERTEX_INPUT_RATE_INSTANCE,
+    vk_util::VertexAttr< float,     offsetof(InstanceData, rotation) >,
+    vk_util::VertexAttr< glm::vec2, offsetof(InstanceData, scale) >,
+    vk_util::VertexAttr< glm::vec2, offsetof(InstanceData, offset) >,
+    vk_util::VertexAttr< glm::vec2, offsetof(InstanceData, position) >,
+    vk_util::VertexAttr< glm::vec3, offsetof(InstanceData, color) >
+>;
+
+// The compute shader writes the same layout for particles.
+static_assert(sizeof(InstanceData) == vk_util::ParticleComputeManager::instance_size);
+
+// A range of consecutive instances drawn with the same mesh.
+//
+// Layers are drawn in increasing order, each from its own command buffer,
+// and the batches of a layer in their order. Layers that change separately,
+// such as entities and particles, should use different layers, so that the
+// others can keep their recorded commands.
+struct InstanceBatch {
+    std::uint32_t mesh = 0;
+    std::uint32_t first_instance = 0;
+    std::uint32_t num_instances = 0;
+    std::uint32_t layer = 0;
+};
 
-    static auto get_binding_desc() {
-        VkVertexInputBindingDescription bd {};
-
-        bd.binding = 0;
-        bd.stride = sizeof(Vertex);
-        bd.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-        return bd;
-    }
-
-    static auto get_attr_desc() {
-        std::vector< VkVertexInputAttributeDescription > ad(2);
-
-        ad[0].binding = 0;
-        ad[0].location = 0;
-        ad[0].format = VK_FORMAT_R32G32_SFLOAT;
-        ad[0].offset = offsetof(Vertex, pos);
-        ad[1].binding = 0;
-        ad[1].location = 1;
-        ad[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        ad[1].offset = offsetof(Vertex, color);
-        return ad;
-    }
+enum class WindowMode {
+    windowed,
+    // No window and no presentation. Frames are rendered into offscreen
+    // images as fast as possible, which works on machines without a display
+    // or a GPU (with a software Vulkan implementation, such as lavapipe).
+    headless
 };
 
 class Window {
@@ -49,38 +120,169 @@ public:
 
     constexpr static int max_frames_in_flight = 2;
 
-    Window(int width, int height) {
-        glfw_init_(width, height);
-        vulkan_init_();
+    // Instances are uploaded through separate buffers: instances copied and
+    // diffed with the previous data, and instances written in place
+    constexpr static std::size_t instance_stream_copied = 0;
+    constexpr static std::size_t instance_stream_mapped = 1;
+    constexpr static std::size_t num_instance_streams   = 2;
+
+    Window(int width, int height, WindowMode mode = WindowMode::windowed) :
+        headless_(mode == WindowMode::headless)
+    {
+        if(!headless_) {
+            op_glfw_env_guard_.emplace();
+            glfw_init_(width, height);
+        }
+        vulkan_init_(width, height);
     }
 
     ~Window() {
         vulkan_destroy_();
-        glfw_destroy_();
+        if(!headless_) glfw_destroy_();
     }
 
+    // Runs until the window is closed, or close is called.
     template<
         typename BeforeRender
     >
     void mainloop(BeforeRender&& before_render) {
-        std::size_t current_frame = 0;
+        while(!should_close_()) {
+            run_frame(before_render);
+        }
+
+        vkDeviceWaitIdle(device_);
+    }
+
+    // Runs one iteration of the main loop. Useful for driving frames
+    // without a loop, such as in benchmarks.
+    template<
+        typename BeforeRender
+    >
+    void run_frame(BeforeRender&& before_render) {
+        profiler_.begin_frame();
 
-        while(!glfwWindowShouldClose(window_)) {
+        if(!headless_) {
+            const auto timer = profiler_.scope(FrameStage::poll_events);
             glfwPollEvents();
+        }
 
-            before_render();
+        // Wait until the GPU is done with the resources of this frame, so
+        // that they can be refilled in before_render. Everything that touches
+        // the resources of the frame on the host, from here to the submission
+        // in draw_frame_, relies on this wait.
+        {
+            const auto timer = profiler_.scope(FrameStage::fence_wait);
+            vkWaitForFences(device_, 1, &in_flight_fences_[current_frame_], VK_TRUE, UINT64_MAX);
+        }
+        op_swap_chain_manager_->release_retired();
+        op_vertex_buffer_manager_->release_retired();
+        for(auto& m : op_instance_buffer_managers_) m->release_retired();
+        record_gpu_times_(current_frame_);
 
-            draw_frame_(current_frame);
-            current_frame = (current_frame + 1) % max_frames_in_flight;
+        {
+            const auto timer = profiler_.scope(FrameStage::before_render);
+            before_render();
         }
 
-        vkDeviceWaitIdle(device_);
+        draw_frame_(current_frame_);
+        current_frame_ = (current_frame_ + 1) % max_frames_in_flight;
     }
 
     // Utilities
     //---------------------------------
+    // The camera of the frames rendered from now on. Moving it re-uploads
+    // and records nothing again.
+    void set_camera(const Camera& camera) {
+        camera_ = camera;
+    }
+    const auto& camera() const { return camera_; }
+
+    // Stops the main loop after the current frame.
+    void close() {
+        close_requested_ = true;
+    }
+
+    // Copies the vertex data into the region of the current frame, in the
+    // device vertex layout. Only the parts that changed since the region was
+    // last uploaded are transferred, so static geometry costs no bandwidth.
     void copy_vertex_data(const std::vector< Vertex >& vs) {
-        op_vertex_buffer_manager_.value().copy_data(vs);
+        const auto timer = profiler_.scope(FrameStage::copy_vertex_data);
+        const auto res = op_vertex_buffer_manager_.value().copy_converted_data(
+            vs, current_frame_, to_device_vertex, op_gpu_timer_->upload_queries(current_frame_)
+        );
+        if(res.buffer_reallocated) op_draw_command_cache_->invalidate();
+    }
+
+    // Adds a static indexed mesh to be drawn with instances, and returns the
+    // mesh index. This waits for the GPU, so it should be used at start up.
+    std::uint32_t add_mesh(const vk_util::IndexedMesh< Vertex >& mesh) {
+        vk_util::IndexedMesh< DeviceVertex > device_mesh;
+        device_mesh.vertices.reserve(mesh.vertices.size());
+        std::transform(mesh.vertices.begin(), mesh.vertices.end(), std::back_inserter(device_mesh.vertices), to_device_vertex);
+        device_mesh.indices = mesh.indices;
+
+        const auto res = op_mesh_buffer_manager_.value().add_mesh(device_mesh);
+        // The mesh buffers are recreated
+        op_draw_command_cache_->invalidate();
+        return res;
+    }
+    // Adds a static mesh given as a triangle list, whose equal vertices are
+    // merged.
+    std::uint32_t add_mesh(const std::vector< Vertex >& mesh_vertices) {
+        return add_mesh(vk_util::make_indexed_mesh(mesh_vertices));
+    }
+
+    // Copies the instance data into the region of the current frame. Only
+    // the parts that changed are transferred. Instances in each batch are
+    // drawn with the mesh of the batch.
+    void copy_instance_data(
+        const std::vector< InstanceData >&  instances,
+        const std::vector< InstanceBatch >& batches
+    ) {
+        auto& manager = op_instance_buffer_managers_[instance_stream_copied].value();
+        const auto res = manager.copy_data(instances, current_frame_, op_gpu_timer_->upload_queries(current_frame_));
+        if(res.buffer_reallocated) op_draw_command_cache_->invalidate();
+        instance_batches_[current_frame_][instance_stream_copied] = batches;
+    }
+
+    // Returns the upload region of the current frame as storage for
+    // num_instances instances, so that they can be written in place. Call
+    // submit_instance_data afterwards. This is a separate buffer from the
+    // one of copy_instance_data, for instances that change every frame, such
+    // as particles, and which are transferred whole.
+    std::span< InstanceData > map_instance_data(std::size_t num_instances) {
+        vk_util::VertexBufferManager::CopyDataResult res {};
+        auto& manager = op_instance_buffer_managers_[instance_stream_mapped].value();
+        const auto data = manager.map_data< InstanceData >(num_instances, current_frame_, &res);
+        if(res.buffer_reallocated) op_draw_command_cache_->invalidate();
+        return data;
+    }
+    // Uploads the instances written to the mapped region. The batches index
+    // the mapped instances.
+    void submit_instance_data(const std::vector< InstanceBatch >& batches) {
+        auto& manager = op_instance_buffer_managers_[instance_stream_mapped].value();
+        manager.submit_data(current_frame_, op_gpu_timer_->upload_queries(current_frame_));
+        instance_batches_[current_frame_][instance_stream_mapped] = batches;
+    }
+
+    // Enables particles simulated by a compute shader on the GPU, drawn with
+    // the mesh. This waits for the GPU, so it should be used at start up.
+    void enable_gpu_particles(std::uint32_t mesh, std::uint32_t capacity) {
+        vkDeviceWaitIdle(device_);
+        const auto& range = op_mesh_buffer_manager_.value().meshes()[mesh];
+        op_particle_compute_manager_.emplace(
+            *op_memory_allocator_, device_, op_pipeline_cache_manager_->pipeline_cache(), capacity,
+            range.first_index, range.num_indices, range.vertex_offset
+        );
+        op_draw_command_cache_->invalidate();
+    }
+    // Queues a burst of GPU particles, emitted in the next frame.
+    void emit_gpu_particles(const vk_util::ParticleBurst& burst) {
+        op_particle_compute_manager_.value().emit(burst);
+    }
+    // Adds time to the GPU particle simulation, simulated in the next frame.
+    void advance_gpu_particles(float dt) {
+        op_particle_compute_manager_.value().advance(dt);
     }
 
     // Accessors
@@ -88,7 +290,55 @@ public:
     auto      & glfw_callbacks()       { return glfw_callbacks_; }
     const auto& glfw_callbacks() const { return glfw_callbacks_; }
 
+    bool headless() const { return headless_; }
+
+    // Graphics pipelines
+    //---------------------------------
+    constexpr static std::size_t pipeline_vertex    = 0;
+    constexpr static std::size_t pipeline_instanced = 1;
+    constexpr static std::size_t num_pipelines      = 2;
+
+    // Descriptions of the graphics pipelines, indexed by the constants above.
+    // The camera is read through a set of the layout (see
+    // CameraBufferManager).
+    static auto make_pipeline_descs(VkDescriptorSetLayout camera_set_layout) {
+        std::vector< vk_util::GraphicsPipelineDesc > descs(num_pipelines);
+
+        const auto vertex_ad = DeviceVertexLayout::get_attr_desc(0);
+        descs[pipeline_vertex] = {
+            &vertex_shader::shader,
+            &fragment_shader::shader,
+            { DeviceVertexLayout::get_binding_desc(0) },
+            { vertex_ad.begin(), vertex_ad.end() },
+            { camera_set_layout }
+        };
+
+        // Only the position of mesh vertices is used, followed by the
+        // instance attributes
+        const auto instance_ad = InstanceDataLayout::get_attr_desc(1, 1);
+        descs[pipeline_instanced] = {
+            &instanced_vertex_shader::shader,
+            &fragment_shader::shader,
+            { DeviceVertexLayout::get_binding_desc(0), InstanceDataLayout::get_binding_desc(1) },
+            { vertex_ad[0] },
+            { camera_set_layout }
+        };
+        {
+            auto& attr_desc = descs[pipeline_instanced].attr_desc;
+            attr_desc.insert(attr_desc.end(), instance_ad.begin(), instance_ad.end());
+        }
+        return descs;
+    }
+
+    // CPU timings of the stages of recent frames
+    auto      & profiler()       { return profiler_; }
+    const auto& profiler() const { return profiler_; }
+
 private:
+    bool should_close_() const {
+        return close_requested_ || (!headless_ && glfwWindowShouldClose(window_));
+    }
+
     static void callback_framebuffer_resize_(GLFWwindow* window, int width, int height) {
         auto p_window = static_cast< Window* >(glfwGetWindowUserPointer(window));
         p_window->framebuffer_resized_ = true;
@@ -119,9 +369,16 @@ private:
 
     }
 
-    void vulkan_init_() {
-        instance_ = vk_util::create_instance();
-        surface_  = vk_util::create_surface(instance_, window_);
+    // In headless mode, the size of the offscreen images is given.
+    void vulkan_init_(int width, int height) {
+        instance_ = vk_util::create_instance(headless_);
+        if(!headless_) {
+            surface_ = vk_util::create_surface(instance_, window_);
+
+            const auto fb_size = glfw_util::get_framebuffer_size(window_);
+            width  = fb_size.width;
+            height = fb_size.height;
+        }
         physical_device_ = vk_util::pick_physical_device(instance_, surface_);
         qf_indices_ = vk_util::find_queue_families(physical_device_, surface_);
 
@@ -133,24 +390,52 @@ private:
         ) = vk_util::create_logical_device(physical_device_, surface_);
 
         transfer_command_pool_ = vk_util::create_transfer_command_pool(device_, qf_indices_);
+        // All buffers and images are sub-allocated from it
+        op_memory_allocator_.emplace(physical_device_, device_);
+        op_gpu_timer_.emplace(physical_device_, *op_memory_allocator_, qf_indices_, max_frames_in_flight);
+        op_pipeline_cache_manager_.emplace(physical_device_, device_, pipeline_cache_file);
 
         op_vertex_buffer_manager_.emplace(
-            physical_device_,
+            *op_memory_allocator_,
+            device_,
+            qf_indices_,
+            transfer_command_pool_,
+            transfer_queue_,
+            max_frames_in_flight
+        );
+        for(auto& m : op_instance_buffer_managers_) {
+            m.emplace(
+                *op_memory_allocator_,
+                device_,
+                qf_indices_,
+                transfer_command_pool_,
+                transfer_queue_,
+                max_frames_in_flight
+            );
+        }
+        op_mesh_buffer_manager_.emplace(
+            *op_memory_allocator_,
             device_,
+            qf_indices_,
             transfer_command_pool_,
             transfer_queue_
         );
 
-        const auto [width, height] = glfw_util::get_framebuffer_size(window_);
+        op_camera_buffer_manager_.emplace(*op_memory_allocator_, device_, max_frames_in_flight);
+
+        pipeline_descs_ = make_pipeline_descs(op_camera_buffer_manager_->set_layout());
+
         op_swap_chain_manager_.emplace(
             physical_device_,
             surface_,
             qf_indices_,
             device_,
+            *op_memory_allocator_,
+            op_pipeline_cache_manager_->pipeline_cache(),
             width, height,
-            Vertex::get_binding_desc(),
-            Vertex::get_attr_desc()
+            pipeline_descs_
         );
+        op_draw_command_cache_.emplace(device_, qf_indices_, max_frames_in_flight, num_recording_workers_());
 
         std::tie(
             image_available_semaphores_,
@@ -164,15 +449,27 @@ private:
     }
 
     void vulkan_destroy_() {
+        // Frames driven by run_frame may still be in flight
+        vkDeviceWaitIdle(device_);
+
         for(std::size_t i = 0; i < max_frames_in_flight; ++i) {
             vkDestroySemaphore(device_, render_finished_semaphores_[i], nullptr);
             vkDestroySemaphore(device_, image_available_semaphores_[i], nullptr);
             vkDestroyFence(device_, in_flight_fences_[i], nullptr);
         }
 
+        op_draw_command_cache_.reset();
         op_swap_chain_manager_.reset();
+        op_camera_buffer_manager_.reset();
 
+        op_particle_compute_manager_.reset();
+        op_mesh_buffer_manager_.reset();
+        for(auto& m : op_instance_buffer_managers_) m.reset();
         op_vertex_buffer_manager_.reset();
+        op_gpu_timer_.reset();
+        op_memory_allocator_.reset();
+        // Saves the pipelines created in this run
+        op_pipeline_cache_manager_.reset();
 
         vkDestroyCommandPool(device_, transfer_command_pool_, nullptr);
 
@@ -190,91 +487,245 @@ private:
             glfwWaitEvents();
         }
 
-        vkDeviceWaitIdle(device_);
-
+        // Frames in flight keep using the old images, which are released
+        // once their fences have signaled
         const auto [width, height] = glfw_util::get_framebuffer_size(window_);
         op_swap_chain_manager_.value().recreate(
             width, height,
-            Vertex::get_binding_desc(),
-            Vertex::get_attr_desc()
+            pipeline_descs_,
+            max_frames_in_flight
         );
-    }
 
-    void draw_frame_(std::size_t frame) {
-        // Fences
-        vkWaitForFences(device_, 1, &in_flight_fences_[frame], VK_TRUE, UINT64_MAX);
+        // The render pass and the pipelines may have been rebuilt
+        op_draw_command_cache_->invalidate();
 
-        // Acquire image from swap chain
-        std::uint32_t image_index;
-        {
-            const auto result = vkAcquireNextImageKHR(
-                device_,
-                op_swap_chain_manager_->swap_chain(),
-                UINT64_MAX,
-                image_available_semaphores_[frame],
-                VK_NULL_HANDLE,
-                &image_index
-            );
+        // The new images are not used by any frame yet
+        images_in_flight_.assign(op_swap_chain_manager_->num_images(), VK_NULL_HANDLE);
+    }
 
-            switch(result) {
+    // Reads the GPU times of the previous use of the frame into the
+    // profiler.
+    void record_gpu_times_(std::size_t frame) {
+        if(const auto times = op_gpu_timer_->begin_frame(frame)) {
+            profiler_.record(FrameStage::gpu_upload,      times->upload);
+            profiler_.record(FrameStage::gpu_render_pass, times->render_pass);
+            profiler_.record(FrameStage::gpu_frame,       times->frame);
+        }
+    }
 
-            case VK_ERROR_OUT_OF_DATE_KHR:
-                vulkan_swap_chain_recreate_();
-                return;
+    // Worker threads recording draw layers, besides the render thread. The
+    // simulation has a thread of its own.
+    static std::size_t num_recording_workers_() {
+        const auto num_threads = std::thread::hardware_concurrency();
+        return num_threads > 2 ? std::min< std::size_t >(num_threads - 2, 3) : 0;
+    }
 
-            case VK_SUCCESS:
-            case VK_SUBOPTIMAL_KHR:
-                break;
+    // Builds the draw states of the layers of the frame: plain vertices,
+    // the layers of the instance batches, and GPU particles.
+    void build_draw_layers_(std::size_t frame) {
+        vk_util::DrawState common;
+        common.swap_chain_extent = op_swap_chain_manager_->swap_chain_extent();
+        common.render_pass = op_swap_chain_manager_->render_pass();
+        // The pipelines have the same set layout
+        common.pipeline_layout = op_swap_chain_manager_->pipeline_layouts()[pipeline_vertex];
+        common.camera_set = op_camera_buffer_manager_->descriptor_set(frame);
+        common.vertex_pipeline = op_swap_chain_manager_->graphics_pipelines()[pipeline_vertex];
+        common.instanced_pipeline = op_swap_chain_manager_->graphics_pipelines()[pipeline_instanced];
+        common.mesh_buffer = op_mesh_buffer_manager_->buffer();
+        common.mesh_index_buffer = op_mesh_buffer_manager_->index_buffer();
+
+        std::size_t num_layers = 0;
+        const auto next_layer = [&]() -> vk_util::DrawState& {
+            if(draw_layers_.size() == num_layers) draw_layers_.emplace_back();
+            auto& ds = draw_layers_[num_layers++];
+            // Keeps the capacity of the draws
+            auto instanced_draws = std::move(ds.instanced_draws);
+            ds = common;
+            ds.instanced_draws = std::move(instanced_draws);
+            ds.instanced_draws.clear();
+            return ds;
+        };
+
+        if(const auto num_vertices = op_vertex_buffer_manager_->num_vertices(frame)) {
+            auto& ds = next_layer();
+            ds.vertex_buffer = op_vertex_buffer_manager_->buffer();
+            ds.vertex_buffer_offset = op_vertex_buffer_manager_->offset(frame);
+            ds.num_vertices = num_vertices;
+        }
 
-            default:
-                throw std::runtime_error("Failed to acquire swap chain image.");
+        // Batches of all streams in order of layer, stable within a layer,
+        // copied instances first
+        const auto& batches = instance_batches_[frame];
+        const auto batch_of = [&](const SortedBatch& b) -> const InstanceBatch& {
+            return batches[b.stream][b.index];
+        };
+        sorted_batches_.clear();
+        for(std::uint32_t s = 0; s < num_instance_streams; ++s) {
+            for(std::uint32_t i = 0; i < batches[s].size(); ++i) sorted_batches_.push_back({ s, i });
+        }
+        std::stable_sort(sorted_batches_.begin(), sorted_batches_.end(), [&](const SortedBatch& a, const SortedBatch& b) {
+            return batch_of(a).layer < batch_of(b).layer;
+        });
+        for(std::size_t i = 0; i < sorted_batches_.size(); ++i) {
+            const auto& batch = batch_of(sorted_batches_[i]);
+            const auto stream = sorted_batches_[i].stream;
+            const bool new_layer = i == 0 || batch.layer != batch_of(sorted_batches_[i - 1]).layer;
+            if(new_layer) next_layer();
+            if(new_layer || stream != sorted_batches_[i - 1].stream) {
+                const auto& manager = *op_instance_buffer_managers_[stream];
+                draw_layers_[num_layers - 1].instanced_draws.push_back({
+                    manager.buffer(),
+                    manager.offset(frame),
+                    {}
+                });
             }
+
+            const auto& mesh = op_mesh_buffer_manager_->meshes()[batch.mesh];
+            draw_layers_[num_layers - 1].instanced_draws.back().draws.push_back({
+                mesh.first_index,
+                mesh.num_indices,
+                mesh.vertex_offset,
+                batch.first_instance,
+                batch.num_instances
+            });
         }
 
-        // Check if a previous frame is using this image
-        if(images_in_flight_[image_index] != VK_NULL_HANDLE) {
-            vkWaitForFences(device_, 1, &images_in_flight_[image_index], VK_TRUE, UINT64_MAX);
+        // Only the live particles, counted on the device, are drawn
+        if(op_particle_compute_manager_) {
+            next_layer().instanced_draws.push_back({
+                op_particle_compute_manager_->instance_buffer(),
+                0,
+                {},
+                op_particle_compute_manager_->indirect_buffer()
+            });
+        }
+
+        draw_layers_.resize(num_layers);
+    }
+
+    void draw_frame_(std::size_t frame) {
+        // Acquire image from swap chain, or take the next offscreen image
+        std::uint32_t image_index;
+        {
+            const auto timer = profiler_.scope(FrameStage::acquire);
+
+            if(headless_) {
+                image_index = next_offscreen_image_;
+                next_offscreen_image_ = (next_offscreen_image_ + 1) % op_swap_chain_manager_->num_images();
+            } else {
+                const auto result = vkAcquireNextImageKHR(
+                    device_,
+                    op_swap_chain_manager_->swap_chain(),
+                    UINT64_MAX,
+                    image_available_semaphores_[frame],
+                    VK_NULL_HANDLE,
+                    &image_index
+                );
+
+                switch(result) {
+
+                case VK_ERROR_OUT_OF_DATE_KHR:
+                    vulkan_swap_chain_recreate_();
+                    return;
+
+                case VK_SUCCESS:
+                case VK_SUBOPTIMAL_KHR:
+                    break;
+
+                default:
+                    throw std::runtime_error("Failed to acquire swap chain image.");
+                }
+            }
+
+            // Check if a previous frame is using this image
+            if(images_in_flight_[image_index] != VK_NULL_HANDLE) {
+                vkWaitForFences(device_, 1, &images_in_flight_[image_index], VK_TRUE, UINT64_MAX);
+            }
+            // Mark the image as now being in use by this frame
+            images_in_flight_[image_index] = in_flight_fences_[frame];
         }
-        // Mark the image as now being in use by this frame
-        images_in_flight_[image_index] = in_flight_fences_[frame];
 
         // Reset and record the command buffer
         //-----------------------------
-        vkResetCommandPool(device_, op_swap_chain_manager_->command_pools()[image_index], 0);
-
-        vk_util::record_graphics_command_buffer(
-            op_swap_chain_manager_->swap_chain_extent(),
-            op_swap_chain_manager_->render_pass(),
-            op_swap_chain_manager_->graphics_pipeline(),
-            op_swap_chain_manager_->framebuffers()[image_index],
-            op_swap_chain_manager_->command_buffers()[image_index],
-            op_vertex_buffer_manager_->buffer(),
-            op_vertex_buffer_manager_->num_vertices()
-        );
+        {
+            const auto timer = profiler_.scope(FrameStage::record);
+
+            vkResetCommandPool(device_, op_swap_chain_manager_->command_pools()[image_index], 0);
+
+            op_camera_buffer_manager_->write(frame, camera_.uniforms());
+            build_draw_layers_(frame);
+            // Draws are only recorded again when they change
+            const auto& draw_command_buffers = op_draw_command_cache_->command_buffers(frame, draw_layers_);
+
+            vk_util::record_graphics_command_buffer(
+                op_swap_chain_manager_->swap_chain_extent(),
+                op_swap_chain_manager_->render_pass(),
+                op_swap_chain_manager_->framebuffers()[image_index],
+                op_swap_chain_manager_->command_buffers()[image_index],
+                draw_command_buffers,
+                // Compute dispatches must be outside of the render pass
+                [this](VkCommandBuffer command_buffer) {
+                    if(op_particle_compute_manager_) {
+                        op_particle_compute_manager_->record(command_buffer);
+                    }
+                },
+                [this, frame](VkCommandBuffer command_buffer) {
+                    op_gpu_timer_->record_resolve(command_buffer, frame);
+                },
+                op_gpu_timer_->graphics_queries(frame)
+            );
+        }
 
         // Set up semaphores and get ready to submit
         //-----------------------------
-        VkSemaphore wait_semaphores[] { image_available_semaphores_[frame] };
+        std::uint32_t num_wait_semaphores = 0;
+        VkSemaphore          wait_semaphores[2 + num_instance_streams] {};
+        VkPipelineStageFlags wait_stages[2 + num_instance_streams] {};
+        // Offscreen images are not shared with a presentation engine
+        if(!headless_) {
+            wait_semaphores[num_wait_semaphores] = image_available_semaphores_[frame];
+            wait_stages[num_wait_semaphores++] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        }
+        // Vertex input must wait for the data transfers of this frame, and
+        // so does the copy of their timestamps
+        constexpr VkPipelineStageFlags transfer_wait_stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+        if(const auto s = op_vertex_buffer_manager_->take_transfer_semaphore(frame); s != VK_NULL_HANDLE) {
+            wait_semaphores[num_wait_semaphores] = s;
+            wait_stages[num_wait_semaphores++] = transfer_wait_stages;
+        }
+        for(auto& m : op_instance_buffer_managers_) {
+            if(const auto s = m->take_transfer_semaphore(frame); s != VK_NULL_HANDLE) {
+                wait_semaphores[num_wait_semaphores] = s;
+                wait_stages[num_wait_semaphores++] = transfer_wait_stages;
+            }
+        }
+
         VkSemaphore signal_semaphores[] { render_finished_semaphores_[frame] };
 
         // Submit command buffer
         VkSubmitInfo si {};
         si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-        VkPipelineStageFlags wait_stages[] { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-        si.waitSemaphoreCount = 1;
+        si.waitSemaphoreCount = num_wait_semaphores;
         si.pWaitSemaphores = wait_semaphores;
         si.pWaitDstStageMask = wait_stages;
         si.commandBufferCount = 1;
         si.pCommandBuffers = &(op_swap_chain_manager_->command_buffers())[image_index];
-        si.signalSemaphoreCount = 1;
+        // Without presentation, nothing waits for rendering to finish
+        si.signalSemaphoreCount = headless_ ? 0 : 1;
         si.pSignalSemaphores = signal_semaphores;
 
-        vkResetFences(device_, 1, &in_flight_fences_[frame]);
-        if(vkQueueSubmit(graphics_queue_, 1, &si, in_flight_fences_[frame]) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to submit draw command buffer.");
+        {
+            const auto timer = profiler_.scope(FrameStage::submit);
+
+            vkResetFences(device_, 1, &in_flight_fences_[frame]);
+            if(vkQueueSubmit(graphics_queue_, 1, &si, in_flight_fences_[frame]) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to submit draw command buffer.");
+            }
         }
 
+        if(headless_) return;
+
         // Presentation
         VkPresentInfoKHR pi {};
         pi.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -287,7 +738,10 @@ private:
         pi.pImageIndices = &image_index;
         pi.pResults = nullptr;
 
+        // Swap chain recreation is included in the time of presentation
         {
+            const auto timer = profiler_.scope(FrameStage::present);
+
             const auto result = vkQueuePresentKHR(present_queue_, &pi);
 
             bool need_swap_chain_recreate = framebuffer_resized_;
@@ -317,7 +771,8 @@ private:
     // Member variables
     //-------------------------------------------------------------------------
 
-    glfw_util::EnvGuard glfw_env_guard_;
+    // Not initialized if headless, which works without a display
+    std::optional< glfw_util::EnvGuard > op_glfw_env_guard_;
 
     // GLFW window
     GLFWwindow*      window_ = nullptr;
@@ -328,7 +783,7 @@ private:
     VkInstance       instance_;
     VkPhysicalDevice physical_device_ = VK_NULL_HANDLE;
 
-    VkSurfaceKHR     surface_;
+    VkSurfaceKHR     surface_ = VK_NULL_HANDLE; // Not created if headless
     vk_util::QueueFamilyIndices qf_indices_;
 
     VkDevice         device_;
@@ -337,10 +792,21 @@ private:
     VkQueue          transfer_queue_;
 
     std::optional< vk_util::SwapChainManager > op_swap_chain_manager_;
+    std::optional< vk_util::DrawCommandCache > op_draw_command_cache_;
 
     VkCommandPool    transfer_command_pool_;
 
     std::optional< vk_util::VertexBufferManager > op_vertex_buffer_manager_;
+    std::array< std::optional< vk_util::VertexBufferManager >, num_instance_streams > op_instance_buffer_managers_;
+    std::optional< vk_util::MeshBufferManager< DeviceVertex > > op_mesh_buffer_manager_;
+    std::optional< vk_util::ParticleComputeManager > op_particle_compute_manager_;
+    std::optional< vk_util::CameraBufferManager > op_camera_buffer_manager_;
+    std::optional< vk_util::GpuFrameTimer > op_gpu_timer_;
+    std::optional< vk_util::MemoryAllocator > op_memory_allocator_;
+    std::optional< vk_util::PipelineCacheManager > op_pipeline_cache_manager_;
+
+    // Graphics pipelines
+    std::vector< vk_util::GraphicsPipelineDesc > pipeline_descs_;
 
     std::array< VkSemaphore, max_frames_in_flight > image_available_semaphores_;
     std::array< VkSemaphore, max_frames_in_flight > render_finished_semaphores_;
@@ -348,7 +814,24 @@ private:
     std::vector< VkFence > images_in_flight_;
 
     // States
+    bool headless_;
+    bool close_requested_ = false;
     bool framebuffer_resized_ = false;
+    std::size_t current_frame_ = 0;
+    std::uint32_t next_offscreen_image_ = 0; // Only if headless
+
+    Camera camera_;
+
+    FrameProfiler profiler_;
+
+    // Instance batches of each frame, and the draws built from them
+    std::array< std::array< std::vector< InstanceBatch >, num_instance_streams >, max_frames_in_flight > instance_batches_;
+    std::vector< vk_util::DrawState > draw_layers_;
+    struct SortedBatch {
+        std::uint32_t stream;
+        std::uint32_t index;
+    };
+    std::vector< SortedBatch > sorted_batches_; // Scratch
 };
 
 